@@ -37,12 +37,19 @@
 #include <libmaple/timer.h>
 #include <libmaple/usart.h>
 
+#include "wirish_time.h"
+
+#include <stdlib.h>
+
 HardwareSerial::HardwareSerial(usart_dev *usart_device,
                                uint8 tx_pin,
                                uint8 rx_pin) {
     this->usart_device = usart_device;
     this->tx_pin = tx_pin;
     this->rx_pin = rx_pin;
+    this->rx_heap = NULL;
+    this->tx_heap = NULL;
+    this->framer = NULL;
 }
 
 /*
@@ -64,10 +71,50 @@ static void disable_timer_if_necessary(timer_dev *dev, uint8 ch) {
 #warning "Unsupported STM32 series; timer conflicts are possible"
 #endif
 
+/* Use the caller's buffer if there is one, otherwise allocate one on
+ * the heap. Any buffer previously allocated here is freed. */
+static uint8 *serial_buffer(uint8 *&heap, uint8 *buf, uint16 size) {
+    free(heap);
+    heap = NULL;
+    if (!buf) {
+        buf = heap = (uint8 *)malloc(size);
+    }
+    return buf;
+}
+
 void HardwareSerial::begin(uint32 baud) 
 {
 	begin(baud,SERIAL_8N1);
 }
+
+void HardwareSerial::begin(uint32 baud, uint8_t config,
+                           uint16 rx_size, uint16 tx_size)
+{
+    begin(baud, config, NULL, rx_size, NULL, tx_size);
+}
+
+void HardwareSerial::begin(uint32 baud, uint8_t config,
+                           uint8 *rx_buf, uint16 rx_size,
+                           uint8 *tx_buf, uint16 tx_size)
+{
+    if (baud > this->usart_device->max_baud || rx_size < 2 || tx_size < 2) {
+        return;
+    }
+
+    /* The old buffers may be in use until the port is stopped. */
+    if (this->usart_device->regs->CR1 & USART_CR1_UE) {
+        end();
+    }
+    rx_buf = serial_buffer(this->rx_heap, rx_buf, rx_size);
+    tx_buf = serial_buffer(this->tx_heap, tx_buf, tx_size);
+    if (!rx_buf || !tx_buf) {
+        /* Out of memory; leave the port stopped and unbuffered. */
+        usart_set_buffers(this->usart_device, NULL, 1, NULL, 1);
+        return;
+    }
+    usart_set_buffers(this->usart_device, rx_buf, rx_size, tx_buf, tx_size);
+    begin(baud, config);
+}
 /*
  * Roger Clark.
  * Note. The config parameter is not currently used. This is a work in progress.  
@@ -83,6 +130,11 @@ void HardwareSerial::begin(uint32 baud, uint8_t config)
         return;
     }
 
+    if (!this->usart_device->rb->buf) {
+        begin(baud, config, USART_RX_BUF_SIZE, USART_TX_BUF_SIZE);
+        return;
+    }
+
     const stm32_pin_info *txi = &PIN_MAP[this->tx_pin];
     const stm32_pin_info *rxi = &PIN_MAP[this->rx_pin];
 
@@ -101,6 +153,91 @@ void HardwareSerial::end(void) {
     usart_disable(this->usart_device);
 }
 
+void HardwareSerial::enableFlowControl(uint8 rts_pin, uint8 cts_pin,
+                                       uint8 flags) {
+    gpio_dev *rts_dev = NULL;
+    gpio_dev *cts_dev = NULL;
+    uint8 rts_bit = 0;
+    uint8 cts_bit = 0;
+
+    if (rts_pin < BOARD_NR_GPIO_PINS) {
+        const stm32_pin_info *rtsi = &PIN_MAP[rts_pin];
+        disable_timer_if_necessary(rtsi->timer_device, rtsi->timer_channel);
+        rts_dev = rtsi->gpio_device;
+        rts_bit = rtsi->gpio_bit;
+    }
+    if (cts_pin < BOARD_NR_GPIO_PINS) {
+        const stm32_pin_info *ctsi = &PIN_MAP[cts_pin];
+        cts_dev = ctsi->gpio_device;
+        cts_bit = ctsi->gpio_bit;
+    }
+    usart_config_gpios_flow(this->usart_device,
+                            cts_dev, cts_bit, rts_dev, rts_bit, flags);
+}
+
+void HardwareSerial::disableFlowControl(void) {
+    usart_config_gpios_flow(this->usart_device, NULL, 0, NULL, 0, 0);
+}
+
+void HardwareSerial::enableRS485(uint8 de_pin) {
+    if (de_pin >= BOARD_NR_GPIO_PINS) {
+        return;
+    }
+    const stm32_pin_info *dei = &PIN_MAP[de_pin];
+    disable_timer_if_necessary(dei->timer_device, dei->timer_channel);
+    gpio_write_bit(dei->gpio_device, dei->gpio_bit, 0);
+    gpio_set_mode(dei->gpio_device, dei->gpio_bit, GPIO_OUTPUT_PP);
+    usart_config_rs485(this->usart_device, dei->gpio_device, dei->gpio_bit);
+}
+
+void HardwareSerial::disableRS485(void) {
+    flush();
+    usart_config_rs485(this->usart_device, NULL, 0);
+}
+
+bool HardwareSerial::enableFraming(uint8 mode, uint16 frame_size,
+                                   uint8 nframes) {
+    disableFraming();
+    if (nframes < 2 || nframes > USART_FRAMES_MAX) {
+        return false;
+    }
+    /* The state and its frame pool share one allocation. */
+    usart_framer *f = (usart_framer *)malloc(sizeof(usart_framer) +
+                                             (uint32)frame_size * nframes);
+    if (!f) {
+        return false;
+    }
+    if (!usart_frame_enable(this->usart_device, f, (usart_framing)mode,
+                            (uint8 *)(f + 1), frame_size, nframes)) {
+        free(f);
+        return false;
+    }
+    this->framer = f;
+    return true;
+}
+
+void HardwareSerial::disableFraming(void) {
+    usart_frame_disable(this->usart_device);
+    free(this->framer);
+    this->framer = NULL;
+}
+
+bool HardwareSerial::enableRxDMA(void) {
+    return usart_rx_dma_enable(this->usart_device);
+}
+
+void HardwareSerial::disableRxDMA(void) {
+    usart_rx_dma_disable(this->usart_device);
+}
+
+bool HardwareSerial::enableTxDMA(void) {
+    return usart_tx_dma_enable(this->usart_device);
+}
+
+void HardwareSerial::disableTxDMA(void) {
+    usart_tx_dma_disable(this->usart_device);
+}
+
 /*
  * I/O
  */
@@ -113,6 +250,23 @@ int HardwareSerial::read(void) {
 	}
 }
 
+/* Copies whole blocks out of the RX buffer. Like Stream::readBytes(),
+ * gives up once no new data has arrived for the stream timeout. */
+size_t HardwareSerial::readBytes(char *buf, size_t len) {
+    size_t rxed = 0;
+    unsigned long startMillis = millis();
+    while (rxed < len) {
+        uint32 n = usart_rx(this->usart_device, (uint8 *)buf + rxed, len - rxed);
+        if (n) {
+            rxed += n;
+            startMillis = millis();
+        } else if (millis() - startMillis >= _timeout) {
+            break;
+        }
+    }
+    return rxed;
+}
+
 int HardwareSerial::available(void) {
     return usart_data_available(this->usart_device);
 }
@@ -135,6 +289,15 @@ size_t HardwareSerial::write(unsigned char ch) {
 	return 1;
 }
 
+size_t HardwareSerial::write(const void *buf, uint32 len) {
+    const uint8 *txbuf = (const uint8 *)buf;
+    uint32 txed = 0;
+    while (txed < len) {
+        txed += usart_tx(this->usart_device, txbuf + txed, len - txed);
+    }
+    return len;
+}
+
 /* edogaldo: Waits for the transmission of outgoing serial data to complete (Arduino 1.0 api specs) */
 void HardwareSerial::flush(void) {
     while(!rb_is_empty(this->usart_device->wb)); // wait for TX buffer empty
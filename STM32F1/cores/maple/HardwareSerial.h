@@ -34,6 +34,7 @@
 #define _WIRISH_HARDWARESERIAL_H_
 
 #include <libmaple/libmaple_types.h>
+#include <libmaple/usart.h>
 
 #include "Print.h"
 #include "boards.h"
@@ -103,6 +104,15 @@ struct usart_dev;
 #define SERIAL_9O2	0B00101011
 */
 
+/* Flow control modes for HardwareSerial::enableFlowControl() */
+#define SERIAL_FLOW_CTS         USART_FLOW_CTS
+#define SERIAL_FLOW_RTS         USART_FLOW_RTS
+#define SERIAL_FLOW_RTS_SOFT    USART_FLOW_RTS_SOFT
+
+/* Framing modes for HardwareSerial::enableFraming() */
+#define SERIAL_FRAMING_COBS     USART_FRAMING_COBS
+#define SERIAL_FRAMING_SLIP     USART_FRAMING_SLIP
+
 /* Roger Clark 
  * Moved macros from hardwareSerial.cpp
  */
@@ -132,6 +142,13 @@ public:
     /* Set up/tear down */
     void begin(uint32 baud);
     void begin(uint32 baud,uint8_t config);
+    /* Buffers are only allocated when a port is first started, from
+     * the heap unless the caller provides them. Defaults to
+     * USART_RX_BUF_SIZE and USART_TX_BUF_SIZE bytes. */
+    void begin(uint32 baud, uint8_t config, uint16 rx_size, uint16 tx_size);
+    void begin(uint32 baud, uint8_t config,
+               uint8 *rx_buf, uint16 rx_size,
+               uint8 *tx_buf, uint16 tx_size);
     void end();
     virtual int available(void);
     virtual int peek(void);
@@ -139,11 +156,55 @@ public:
     int availableForWrite(void);
     virtual void flush(void);
     virtual size_t write(uint8_t);
+    virtual size_t write(const void *buf, uint32 len);
     inline size_t write(unsigned long n) { return write((uint8_t)n); }
     inline size_t write(long n) { return write((uint8_t)n); }
     inline size_t write(unsigned int n) { return write((uint8_t)n); }
     inline size_t write(int n) { return write((uint8_t)n); }
     using Print::write;
+    size_t readBytes(char *buf, size_t len);
+    size_t readBytes(uint8_t *buf, size_t len) { return readBytes((char *)buf, len); }
+
+    /* Receive by circular DMA instead of one interrupt per byte.
+     * Call after begin(); returns false if the port has no RX DMA. */
+    bool enableRxDMA(void);
+    void disableRxDMA(void);
+    /* Transmit by DMA, one interrupt per contiguous span of the TX
+     * buffer. Call after begin(); returns false if not available. */
+    bool enableTxDMA(void);
+    void disableTxDMA(void);
+
+    /* RTS/CTS flow control. Call after begin(). Pass a pin number of
+     * 0xFF for an unused pin. Hardware RTS/CTS only work on the
+     * USART's own RTS/CTS pins; SERIAL_FLOW_RTS_SOFT drives any pin
+     * from the RX buffer fill level. */
+    void enableFlowControl(uint8 rts_pin, uint8 cts_pin,
+                           uint8 flags = SERIAL_FLOW_CTS | SERIAL_FLOW_RTS_SOFT);
+    void disableFlowControl(void);
+
+    /* RS-485 half duplex: de_pin is raised while transmitting and
+     * released from the transmission complete interrupt. */
+    void enableRS485(uint8 de_pin);
+    void disableRS485(void);
+    /* Address mark wake-up, for 9-bit modes (e.g. SERIAL_9N1). After
+     * mute(), no bytes are received until one addressed to us. */
+    void setAddress(uint8 addr) { usart_set_address(this->usart_device, addr); }
+    void mute(void) { usart_mute(this->usart_device); }
+    void writeAddress(uint8 addr) { usart_send_address(this->usart_device, addr); }
+
+    /* Framed receive: the ISR decodes COBS or SLIP frames into a pool
+     * of nframes buffers. readFrame() returns the oldest frame's length
+     * (or -1) and points frame at it; it stays valid until
+     * releaseFrame(). Bytes no longer reach read() while enabled. */
+    bool enableFraming(uint8 mode, uint16 frame_size, uint8 nframes = 4);
+    void disableFraming(void);
+    int readFrame(const uint8 **frame) { return usart_frame_get(this->usart_device, frame); }
+    void releaseFrame(void) { usart_frame_release(this->usart_device); }
+
+    /* Error counters and buffer high-water marks, for tuning buffer
+     * sizes and baud rates. See struct usart_stats. */
+    const usart_stats& getStats(void) { return this->usart_device->stats; }
+    void resetStats(void) { usart_reset_stats(this->usart_device); }
 
     /* Pin accessors */
     int txPin(void) { return this->tx_pin; }
@@ -158,6 +219,9 @@ private:
     struct usart_dev *usart_device;
     uint8 tx_pin;
     uint8 rx_pin;
+    uint8 *rx_heap;             /* RX buffer, if allocated by begin() */
+    uint8 *tx_heap;             /* TX buffer, if allocated by begin() */
+    usart_framer *framer;       /* Framed receive state and buffers */
   protected:
 #if 0  
     volatile uint8_t * const _ubrrh;
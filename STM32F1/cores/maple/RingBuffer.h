@@ -0,0 +1,164 @@
+/******************************************************************************
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+/**
+ * @file cores/maple/RingBuffer.h
+ * @brief Lock-free single-producer/single-consumer ring buffer.
+ *
+ * RingBuffer<T, N> holds up to N items of type T, where N must be a
+ * power of two. The head and tail are free-running 32-bit counters
+ * that are only masked when indexing the storage, so there's no
+ * wasted slot and no branch on wrap-around.
+ *
+ * One context (e.g. an ISR) may insert while another (e.g. the main
+ * loop) removes, without disabling interrupts. Only the producer
+ * writes the tail and only the consumer writes the head.
+ *
+ * T must be safe to copy with memcpy(), since write() and read()
+ * move blocks of items that way.
+ *
+ * Unlike libmaple's ring_buffer, this doesn't depend on anything but
+ * the compiler, so it also builds on the host.
+ */
+
+#ifndef _WIRISH_RINGBUFFER_H_
+#define _WIRISH_RINGBUFFER_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/* Keep the compiler from moving item accesses across index loads and
+ * updates.
+ * Enough for an ISR and thread mode sharing a single Cortex-M3 core. */
+#define RINGBUFFER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+template <typename T, uint32_t N>
+class RingBuffer {
+    static_assert(N >= 2 && (N & (N - 1)) == 0,
+                  "RingBuffer size must be a power of two");
+
+public:
+    RingBuffer() : head(0), tail(0) {}
+
+    /* Capacity and fill level */
+    static uint32_t capacity(void) { return N; }
+    uint32_t available(void) const { return tail - head; }
+    uint32_t availableForWrite(void) const { return N - (tail - head); }
+    bool isEmpty(void) const { return tail == head; }
+    bool isFull(void) const { return (tail - head) == N; }
+
+    /* Producer side. Returns false if the buffer is full. */
+    bool push(const T &item) {
+        uint32_t t = tail;
+        uint32_t h = head;
+        RINGBUFFER_BARRIER();
+        if (t - h == N) {
+            return false;
+        }
+        buf[t & (N - 1)] = item;
+        RINGBUFFER_BARRIER();
+        tail = t + 1;
+        return true;
+    }
+
+    /* Consumer side. Returns false if the buffer is empty. */
+    bool pop(T &item) {
+        uint32_t h = head;
+        uint32_t t = tail;
+        RINGBUFFER_BARRIER();
+        if (t == h) {
+            return false;
+        }
+        item = buf[h & (N - 1)];
+        RINGBUFFER_BARRIER();
+        head = h + 1;
+        return true;
+    }
+
+    /* Consumer side. Look at the next item without removing it. */
+    bool peek(T &item) const {
+        uint32_t h = head;
+        uint32_t t = tail;
+        RINGBUFFER_BARRIER();
+        if (t == h) {
+            return false;
+        }
+        item = buf[h & (N - 1)];
+        return true;
+    }
+
+    /* Producer side. Inserts as many of items[0..len) as fit, with at
+     * most two copies around the wrap point. Returns the count. */
+    uint32_t write(const T *items, uint32_t len) {
+        uint32_t t = tail;
+        uint32_t room = N - (t - head);
+        RINGBUFFER_BARRIER();
+        uint32_t idx = t & (N - 1);
+        uint32_t first;
+        if (len > room) {
+            len = room;
+        }
+        first = N - idx;
+        if (first > len) {
+            first = len;
+        }
+        memcpy(&buf[idx], items, first * sizeof(T));
+        memcpy(&buf[0], items + first, (len - first) * sizeof(T));
+        RINGBUFFER_BARRIER();
+        tail = t + len;
+        return len;
+    }
+
+    /* Consumer side. Removes up to len items into items[], with at
+     * most two copies around the wrap point. Returns the count. */
+    uint32_t read(T *items, uint32_t len) {
+        uint32_t h = head;
+        uint32_t avail = tail - h;
+        RINGBUFFER_BARRIER();
+        uint32_t idx = h & (N - 1);
+        uint32_t first;
+        if (len > avail) {
+            len = avail;
+        }
+        first = N - idx;
+        if (first > len) {
+            first = len;
+        }
+        memcpy(items, &buf[idx], first * sizeof(T));
+        memcpy(items + first, &buf[0], (len - first) * sizeof(T));
+        RINGBUFFER_BARRIER();
+        head = h + len;
+        return len;
+    }
+
+    /* Consumer side. Discard everything currently stored. */
+    void clear(void) { head = tail; }
+
+private:
+    T buf[N];
+    volatile uint32_t head;     /* Count of items removed */
+    volatile uint32_t tail;     /* Count of items inserted */
+};
+
+#endif
@@ -33,14 +33,46 @@
  */
 
 #include <libmaple/usart.h>
+#include "usart_private.h"
+
+/**
+ * @brief Set the storage used by a serial port's RX and TX buffers.
+ *
+ * Serial ports have no buffer storage of their own, so this must be
+ * called before a port is used. The buffers may be any size from 2
+ * to 65535 bytes, and must stay valid while the port is in use.
+ *
+ * The serial port must be disabled.
+ *
+ * @param dev     Serial port whose buffers to set
+ * @param rx_buf  RX buffer storage
+ * @param rx_size Size of rx_buf, in bytes
+ * @param tx_buf  TX buffer storage
+ * @param tx_size Size of tx_buf, in bytes
+ * @see usart_init()
+ */
+void usart_set_buffers(usart_dev *dev,
+                       uint8 *rx_buf, uint16 rx_size,
+                       uint8 *tx_buf, uint16 tx_size) {
+    rb_init(dev->rb, rx_size, rx_buf);
+    rb_init(dev->wb, tx_size, tx_buf);
+    /* Software RTS may have been set up for the old RX buffer. */
+    usart_rts_marks(dev);
+}
 
 /**
  * @brief Initialize a serial port.
+ *
+ * Empties the port's buffers, which must have been set with
+ * usart_set_buffers().
+ *
  * @param dev         Serial port to be initialized
  */
 void usart_init(usart_dev *dev) {
-    rb_init(dev->rb, USART_RX_BUF_SIZE, dev->rx_buf);
-    rb_init(dev->wb, USART_TX_BUF_SIZE, dev->tx_buf);
+    usart_rx_dma_disable(dev);
+    usart_tx_dma_disable(dev);
+    usart_reset_rx(dev);
+    usart_reset_tx(dev);
     rcc_clk_enable(dev->clk_id);
     nvic_irq_enable(dev->irq_num);
 }
@@ -76,6 +108,9 @@ void usart_disable(usart_dev *dev) {
     while((regs->CR1 & USART_CR1_UE) && !(regs->SR & USART_SR_TC))
         ;
 
+    usart_rx_dma_disable(dev);
+    usart_tx_dma_disable(dev);
+
     /* Disable UE */
     regs->CR1 &= ~USART_CR1_UE;
 
@@ -84,29 +119,58 @@ void usart_disable(usart_dev *dev) {
     usart_reset_tx(dev);
 }
 
+static inline void usart_tx_high_water(usart_dev *dev) {
+    uint16 count = rb_full_count(dev->wb);
+    if (count > dev->stats.tx_high_water) {
+        dev->stats.tx_high_water = count;
+    }
+}
+
 /**
  * @brief Nonblocking USART transmit
  * @param dev Serial port to transmit over
  * @param buf Buffer to transmit
  * @param len Maximum number of bytes to transmit
- * @return Number of bytes transmitted
+ * @return Number of bytes transmitted. If the port isn't enabled or
+ *         has no TX buffer, the data is discarded and len is returned.
  */
 uint32 usart_tx(usart_dev *dev, const uint8 *buf, uint32 len) {
     usart_reg_map *regs = dev->regs;
     uint32 txed = 0;
-    while (rb_is_empty(dev->wb) && (regs->SR & USART_SR_TXE) && (txed < len)) {
-        regs->DR = buf[txed++];
+    if (!dev->wb->buf || !(regs->CR1 & USART_CR1_UE)) {
+        /* Not started, or out of memory: drop the data rather than
+         * leave callers waiting for room that never comes. */
+        return len;
+    }
+    if (len > 0xFFFF) {
+        len = 0xFFFF;
     }
-    regs->CR1 &= ~((uint32)USART_CR1_TXEIE); // disable TXEIE while populating the buffer
-    while (txed < len) {
-        if (rb_safe_insert(dev->wb, buf[txed])) {
-            txed++;
+    if (dev->de_dev) {
+        /* Keep the TC interrupt from releasing the RS-485 driver
+         * while this data is being queued. */
+        regs->CR1 &= ~((uint32)USART_CR1_TCIE);
+        gpio_write_bit(dev->de_dev, dev->de_bit, 1);
+    }
+    if (dev->tx_dma_regs) {
+        txed = rb_write_block(dev->wb, buf, len);
+        usart_tx_high_water(dev);
+        /* If a span is in flight, its completion picks these up. */
+        if (!dev->tx_dma_len) {
+            usart_tx_dma_start(dev);
+        }
+    } else {
+        while (rb_is_empty(dev->wb) && (regs->SR & USART_SR_TXE) && (txed < len)) {
+            regs->DR = buf[txed++];
+        }
+        regs->CR1 &= ~((uint32)USART_CR1_TXEIE); // disable TXEIE while populating the buffer
+        txed += rb_write_block(dev->wb, buf + txed, len - txed);
+        usart_tx_high_water(dev);
+        if (!rb_is_empty(dev->wb)) {
+            regs->CR1 |= USART_CR1_TXEIE;
         }
-        else
-            break;
     }
-    if (!rb_is_empty(dev->wb)) {
-        regs->CR1 |= USART_CR1_TXEIE;
+    if (dev->de_dev) {
+        regs->CR1 |= USART_CR1_TCIE;
     }
     return txed;
 }
@@ -119,14 +183,262 @@ uint32 usart_tx(usart_dev *dev, const uint8 *buf, uint32 len) {
  * @return Number of bytes received
  */
 uint32 usart_rx(usart_dev *dev, uint8 *buf, uint32 len) {
-    uint32 rxed = 0;
-    while (usart_data_available(dev) && rxed < len) {
-        *buf++ = usart_getc(dev);
-        rxed++;
+    uint32 rxed;
+    if (len > 0xFFFF) {
+        len = 0xFFFF;
+    }
+    rxed = rb_read_block(dev->rb, buf, len);
+    if (dev->rts_held) {
+        usart_rts_release(dev);
     }
     return rxed;
 }
 
+/**
+ * @brief Reassert software RTS if the RX buffer has drained enough.
+ *
+ * Called after reading from a port whose software RTS is deasserted.
+ *
+ * @param dev Serial port to check
+ * @see usart_config_gpios_flow()
+ */
+void usart_rts_release(usart_dev *dev) {
+    if (rb_full_count(dev->rb) <= dev->rts_low) {
+        dev->rts_held = 0;
+        gpio_write_bit(dev->rts_dev, dev->rts_bit, 0);
+    }
+}
+
+/**
+ * @brief Drive an RS-485 transceiver's driver enable (DE) pin.
+ *
+ * DE is raised whenever data is queued for transmission, and lowered
+ * again from the transmission complete interrupt once the last byte
+ * has left the shift register.
+ *
+ * The DE pin must already be configured as an output.
+ *
+ * @param dev    Serial port to use
+ * @param de_dev DE pin gpio_dev, or NULL to stop driving DE
+ * @param de     DE pin bit on de_dev
+ */
+void usart_config_rs485(usart_dev *dev, struct gpio_dev *de_dev, uint8 de) {
+    dev->regs->CR1 &= ~((uint32)USART_CR1_TCIE);
+    dev->de_dev = NULL;
+    if (de_dev) {
+        gpio_write_bit(de_dev, de, 0);
+        dev->de_bit = de;
+        dev->de_dev = de_dev;
+    }
+}
+
+/**
+ * @brief Set a serial port's multiprocessor address.
+ *
+ * Enables address mark wake-up: once muted with usart_mute(), the
+ * receiver ignores all bytes (raising no interrupts) until one with
+ * its most significant bit set and its low four bits equal to addr
+ * arrives. Use with 9 data bits, e.g. SERIAL_9N1, so the address
+ * mark is the ninth bit.
+ *
+ * @param dev  Serial port to use
+ * @param addr Node address, 0 to 15
+ * @see usart_mute()
+ * @see usart_send_address()
+ */
+void usart_set_address(usart_dev *dev, uint8 addr) {
+    usart_reg_map *regs = dev->regs;
+    regs->CR2 = (regs->CR2 & ~USART_CR2_ADD) | (addr & USART_CR2_ADD);
+    regs->CR1 |= USART_CR1_WAKE_ADDR;
+}
+
+/**
+ * @brief Put a serial port's receiver in mute mode.
+ *
+ * The receiver wakes on its address, as set by usart_set_address().
+ * Call once done with a frame to skip the rest of the bus traffic.
+ *
+ * @param dev Serial port to mute
+ */
+void usart_mute(usart_dev *dev) {
+    usart_reg_map *regs = dev->regs;
+    /* RWU may only be set while RXNE is clear. */
+    while (regs->SR & USART_SR_RXNE)
+        ;
+    regs->CR1 |= USART_CR1_RWU;
+}
+
+/**
+ * @brief Send an address byte (ninth bit set) on a serial port.
+ *
+ * Blocks until all previously queued data has been sent.
+ *
+ * @param dev  Serial port to send on
+ * @param addr Address of the node to wake
+ */
+void usart_send_address(usart_dev *dev, uint8 addr) {
+    usart_reg_map *regs = dev->regs;
+    while (!rb_is_empty(dev->wb) || dev->tx_dma_len)
+        ;
+    if (dev->de_dev) {
+        regs->CR1 &= ~((uint32)USART_CR1_TCIE);
+        gpio_write_bit(dev->de_dev, dev->de_bit, 1);
+    }
+    while (!(regs->SR & USART_SR_TXE))
+        ;
+    regs->DR = 0x100 | addr;
+    if (dev->de_dev) {
+        regs->CR1 |= USART_CR1_TCIE;
+    }
+}
+
+/**
+ * @brief Receive COBS or SLIP frames instead of a byte stream.
+ *
+ * The USART interrupt handler decodes each received byte into the
+ * current frame buffer, and queues the frame when its delimiter
+ * arrives. The application then takes whole decoded frames with
+ * usart_frame_get(), without a per-byte parse loop. Up to nframes - 1
+ * frames can be queued while the next one is being received; frames
+ * arriving when none is free are dropped.
+ *
+ * Not for use with RX DMA.
+ *
+ * @param dev        Serial port to receive frames on
+ * @param framer     Framed receive state
+ * @param mode       USART_FRAMING_COBS or USART_FRAMING_SLIP
+ * @param pool       Storage for nframes * frame_size bytes
+ * @param frame_size Largest decoded frame, in bytes
+ * @param nframes    Number of frame buffers, 2 to USART_FRAMES_MAX
+ * @return 1 on success, 0 on bad arguments.
+ * @see usart_frame_disable()
+ */
+int usart_frame_enable(usart_dev *dev, usart_framer *framer,
+                       usart_framing mode, uint8 *pool,
+                       uint16 frame_size, uint8 nframes) {
+    if (nframes < 2 || nframes > USART_FRAMES_MAX || !frame_size) {
+        return 0;
+    }
+    memset(framer, 0, sizeof(*framer));
+    framer->pool = pool;
+    framer->frame_size = frame_size;
+    framer->nframes = nframes;
+    framer->mode = mode;
+    dev->framer = framer;
+    return 1;
+}
+
+/**
+ * @brief Go back to receiving a byte stream into the RX buffer.
+ *
+ * Frames not yet taken are discarded.
+ *
+ * @param dev Serial port to stop framed receive on.
+ */
+void usart_frame_disable(usart_dev *dev) {
+    dev->framer = NULL;
+}
+
+/**
+ * @brief Get the oldest complete frame received on a serial port.
+ *
+ * The frame stays valid, and is returned again by later calls, until
+ * it's released with usart_frame_release().
+ *
+ * @param dev   Serial port in framed receive mode
+ * @param frame Set to the decoded frame
+ * @return Length of the frame, or -1 if none is waiting.
+ */
+int32 usart_frame_get(usart_dev *dev, const uint8 **frame) {
+    usart_framer *f = dev->framer;
+    uint8 head;
+    if (!f || f->head == f->tail) {
+        return -1;
+    }
+    head = f->head;
+    *frame = f->pool + (uint32)head * f->frame_size;
+    return f->len[head];
+}
+
+/**
+ * @brief Give the frame from usart_frame_get() back to the receiver.
+ * @param dev Serial port in framed receive mode
+ */
+void usart_frame_release(usart_dev *dev) {
+    usart_framer *f = dev->framer;
+    if (f && f->head != f->tail) {
+        f->head = (f->head + 1 == f->nframes) ? 0 : f->head + 1;
+    }
+}
+
+/* Append a decoded byte to the current frame. */
+static inline void frame_put(usart_framer *f, uint8 byte) {
+    if (f->pos < f->frame_size) {
+        f->pool[(uint32)f->tail * f->frame_size + f->pos++] = byte;
+    } else {
+        f->state |= USART_FRAMER_BAD;
+    }
+}
+
+/* Delimiter seen: queue the current frame if it's good. */
+static void frame_end(usart_framer *f) {
+    uint8 next = (f->tail + 1 == f->nframes) ? 0 : f->tail + 1;
+    if (f->pos) {
+        if ((f->state & USART_FRAMER_BAD) || next == f->head) {
+            f->dropped++;
+        } else {
+            f->len[f->tail] = f->pos;
+            f->tail = next;
+        }
+    }
+    f->pos = 0;
+    f->left = 0;
+    f->state = 0;
+}
+
+/**
+ * @brief Decode one received byte. Called from the USART ISR.
+ */
+void _usart_frame_rx(usart_framer *f, uint8 byte) {
+    if (f->mode == USART_FRAMING_SLIP) {
+        if (byte == 0xC0) {             /* END */
+            frame_end(f);
+        } else if (byte == 0xDB) {      /* ESC */
+            f->state |= USART_FRAMER_ESC;
+        } else {
+            if (f->state & USART_FRAMER_ESC) {
+                f->state &= ~USART_FRAMER_ESC;
+                byte = (byte == 0xDC) ? 0xC0 : (byte == 0xDD) ? 0xDB : byte;
+            }
+            frame_put(f, byte);
+        }
+        return;
+    }
+
+    /* COBS */
+    if (byte == 0) {
+        if (f->left) {
+            f->state |= USART_FRAMER_BAD; /* frame ended mid-block */
+        }
+        frame_end(f);
+    } else if (f->left) {
+        frame_put(f, byte);
+        f->left--;
+    } else {
+        /* Code byte: the previous block ends in an implied zero
+         * unless it was a full 254-byte block. */
+        if (f->state & USART_FRAMER_ZERO) {
+            frame_put(f, 0);
+        }
+        f->left = byte - 1;
+        if (byte == 0xFF) {
+            f->state &= ~USART_FRAMER_ZERO;
+        } else {
+            f->state |= USART_FRAMER_ZERO;
+        }
+    }
+}
+
 /**
  * @brief Transmit an unsigned integer to the specified serial port in
  *        decimal format.
@@ -34,8 +34,47 @@
 
 #include <libmaple/usart.h>
 #include <libmaple/gpio.h>
+#include <libmaple/dma.h>
 #include "usart_private.h"
 
+/*
+ * DMA interrupt handlers
+ */
+
+static void usart1_rx_dma_irq(void) {
+    usart_rx_dma_sync(USART1);
+}
+
+static void usart1_tx_dma_irq(void) {
+    usart_tx_dma_irq(USART1);
+}
+
+static void usart2_rx_dma_irq(void) {
+    usart_rx_dma_sync(USART2);
+}
+
+static void usart2_tx_dma_irq(void) {
+    usart_tx_dma_irq(USART2);
+}
+
+static void usart3_rx_dma_irq(void) {
+    usart_rx_dma_sync(USART3);
+}
+
+static void usart3_tx_dma_irq(void) {
+    usart_tx_dma_irq(USART3);
+}
+
+#if defined(STM32_HIGH_DENSITY) || defined(STM32_XL_DENSITY)
+static void uart4_rx_dma_irq(void) {
+    usart_rx_dma_sync(UART4);
+}
+
+static void uart4_tx_dma_irq(void) {
+    usart_tx_dma_irq(UART4);
+}
+#endif
+
 /*
  * Devices
  */
@@ -49,6 +88,10 @@ static usart_dev usart1 = {
     .max_baud = 4500000UL,
     .clk_id   = RCC_USART1,
     .irq_num  = NVIC_USART1,
+    .rx_dma_req     = DMA_REQ_SRC_USART1_RX,
+    .rx_dma_handler = usart1_rx_dma_irq,
+    .tx_dma_req     = DMA_REQ_SRC_USART1_TX,
+    .tx_dma_handler = usart1_tx_dma_irq,
 };
 /** USART1 device */
 usart_dev *USART1 = &usart1;
@@ -62,6 +105,10 @@ static usart_dev usart2 = {
     .max_baud = 2250000UL,
     .clk_id   = RCC_USART2,
     .irq_num  = NVIC_USART2,
+    .rx_dma_req     = DMA_REQ_SRC_USART2_RX,
+    .rx_dma_handler = usart2_rx_dma_irq,
+    .tx_dma_req     = DMA_REQ_SRC_USART2_TX,
+    .tx_dma_handler = usart2_tx_dma_irq,
 };
 /** USART2 device */
 usart_dev *USART2 = &usart2;
@@ -75,6 +122,10 @@ static usart_dev usart3 = {
     .max_baud = 2250000UL,
     .clk_id   = RCC_USART3,
     .irq_num  = NVIC_USART3,
+    .rx_dma_req     = DMA_REQ_SRC_USART3_RX,
+    .rx_dma_handler = usart3_rx_dma_irq,
+    .tx_dma_req     = DMA_REQ_SRC_USART3_TX,
+    .tx_dma_handler = usart3_tx_dma_irq,
 };
 /** USART3 device */
 usart_dev *USART3 = &usart3;
@@ -89,6 +140,10 @@ static usart_dev uart4 = {
     .max_baud = 2250000UL,
     .clk_id   = RCC_UART4,
     .irq_num  = NVIC_UART4,
+    .rx_dma_req     = DMA_REQ_SRC_UART4_RX,
+    .rx_dma_handler = uart4_rx_dma_irq,
+    .tx_dma_req     = DMA_REQ_SRC_UART4_TX,
+    .tx_dma_handler = uart4_tx_dma_irq,
 };
 /** UART4 device */
 usart_dev *UART4 = &uart4;
@@ -102,6 +157,7 @@ static usart_dev uart5 = {
     .max_baud = 2250000UL,
     .clk_id   = RCC_UART5,
     .irq_num  = NVIC_UART5,
+    /* UART5 has no DMA request line */
 };
 /** UART5 device */
 usart_dev *UART5 = &uart5;
@@ -162,6 +218,32 @@ Word length of 9 bit with parity is not supported.
 	udev->regs->CR2  = (udev->regs->CR2 & 0B1100111111111111) | ((uint32_t)(flags&0x30)<<8);
 }
 
+void usart_config_gpios_flow(usart_dev *udev,
+                             gpio_dev *cts_dev, uint8 cts,
+                             gpio_dev *rts_dev, uint8 rts,
+                             unsigned flags) {
+    usart_reg_map *regs = udev->regs;
+
+    regs->CR3 &= ~(USART_CR3_CTSE | USART_CR3_RTSE);
+    udev->rts_dev = NULL;
+    udev->rts_held = 0;
+
+    if ((flags & USART_FLOW_CTS) && cts_dev) {
+        gpio_set_mode(cts_dev, cts, GPIO_INPUT_FLOATING);
+        regs->CR3 |= USART_CR3_CTSE;
+    }
+    if ((flags & USART_FLOW_RTS) && rts_dev) {
+        gpio_set_mode(rts_dev, rts, GPIO_AF_OUTPUT_PP);
+        regs->CR3 |= USART_CR3_RTSE;
+    } else if ((flags & USART_FLOW_RTS_SOFT) && rts_dev) {
+        udev->rts_bit = rts;
+        usart_rts_marks(udev);
+        gpio_write_bit(rts_dev, rts, 0);
+        gpio_set_mode(rts_dev, rts, GPIO_OUTPUT_PP);
+        udev->rts_dev = rts_dev;
+    }
+}
+
 void usart_set_baud_rate(usart_dev *dev, uint32 clock_speed, uint32 baud) {
     uint32 integer_part;
     uint32 fractional_part;
@@ -182,6 +264,188 @@ void usart_set_baud_rate(usart_dev *dev, uint32 clock_speed, uint32 baud) {
     dev->regs->BRR = (uint16)tmp;
 }
 
+static dma_dev* usart_dma_dev(dma_request_src req) {
+#if defined(STM32_HIGH_DENSITY) || defined(STM32_XL_DENSITY)
+    if ((rcc_clk_id)(req >> 3) == RCC_DMA2) {
+        return DMA2;
+    }
+#else
+    (void)req;
+#endif
+    return DMA1;
+}
+
+/**
+ * @brief Receive into a serial port's RX buffer using circular DMA.
+ *
+ * Instead of taking an RXNE interrupt per byte, the DMA channel
+ * serving the port's RX request writes straight into the RX ring
+ * buffer. The ring buffer's tail is advanced on the USART IDLE
+ * interrupt and on DMA half/full transfer interrupts, i.e. once per
+ * burst or once per half buffer, whichever comes first.
+ *
+ * If the application falls more than a full buffer behind, the DMA
+ * channel overwrites unread data.
+ *
+ * The serial port must already be initialized and enabled. The DMA
+ * channel must not be used by anything else while RX DMA is enabled.
+ *
+ * @param dev Serial port to receive on.
+ * @return 1 on success, 0 if the port can't use RX DMA.
+ * @see usart_rx_dma_disable()
+ */
+int usart_rx_dma_enable(usart_dev *dev) {
+    usart_reg_map *regs = dev->regs;
+    ring_buffer *rb = dev->rb;
+    dma_dev *dma;
+    dma_tube tube;
+    dma_tube_config cfg;
+
+    if (!dev->rx_dma_req) {
+        return 0;
+    }
+    dma = usart_dma_dev(dev->rx_dma_req);
+    tube = (dma_tube)(dev->rx_dma_req & 0x7);
+
+    cfg.tube_src = &regs->DR;
+    cfg.tube_src_size = DMA_SIZE_8BITS;
+    cfg.tube_dst = rb->buf;
+    cfg.tube_dst_size = DMA_SIZE_8BITS;
+    cfg.tube_nr_xfers = rb->size + 1;
+    cfg.tube_flags = (DMA_CFG_DST_INC | DMA_CFG_CIRC |
+                      DMA_CFG_HALF_CMPLT_IE | DMA_CFG_CMPLT_IE);
+    cfg.target_data = NULL;
+    cfg.tube_req_src = dev->rx_dma_req;
+
+    dma_init(dma);
+    if (dma_tube_cfg(dma, tube, &cfg) != DMA_TUBE_CFG_SUCCESS) {
+        return 0;
+    }
+    dma_attach_interrupt(dma, tube, dev->rx_dma_handler);
+
+    regs->CR1 &= ~((uint32)USART_CR1_RXNEIE);
+    usart_reset_rx(dev);
+    rb->head = 0;
+    rb->tail = 0;
+    dev->rx_dma_regs = dma_tube_regs(dma, tube);
+    regs->CR3 |= USART_CR3_DMAR;
+    dma_enable(dma, tube);
+    regs->CR1 |= USART_CR1_IDLEIE;
+    return 1;
+}
+
+/**
+ * @brief Stop receiving by DMA and go back to RXNE interrupts.
+ *
+ * Data already received stays in the RX buffer.
+ *
+ * @param dev Serial port to stop RX DMA on.
+ * @see usart_rx_dma_enable()
+ */
+void usart_rx_dma_disable(usart_dev *dev) {
+    usart_reg_map *regs = dev->regs;
+    dma_dev *dma;
+    dma_tube tube;
+
+    if (!dev->rx_dma_regs) {
+        return;
+    }
+    dma = usart_dma_dev(dev->rx_dma_req);
+    tube = (dma_tube)(dev->rx_dma_req & 0x7);
+
+    regs->CR1 &= ~((uint32)USART_CR1_IDLEIE);
+    regs->CR3 &= ~((uint32)USART_CR3_DMAR);
+    dma_disable(dma, tube);
+    dma_detach_interrupt(dma, tube);
+    usart_rx_dma_sync(dev);
+    dev->rx_dma_regs = NULL;
+    regs->CR1 |= USART_CR1_RXNEIE;
+}
+
+/**
+ * @brief Transmit from a serial port's TX buffer using DMA.
+ *
+ * Once enabled, usart_tx() only queues data into the TX ring buffer.
+ * A DMA channel then sends the longest contiguous span of queued
+ * data, and re-arms itself from its transfer complete interrupt with
+ * the next span (e.g. after the buffer wraps around). That's one
+ * interrupt per span, rather than one TXE interrupt per byte.
+ *
+ * The serial port must already be initialized and enabled. The DMA
+ * channel must not be used by anything else while TX DMA is enabled.
+ *
+ * @param dev Serial port to transmit on.
+ * @return 1 on success, 0 if the port can't use TX DMA.
+ * @see usart_tx_dma_disable()
+ */
+int usart_tx_dma_enable(usart_dev *dev) {
+    usart_reg_map *regs = dev->regs;
+    ring_buffer *wb = dev->wb;
+    dma_dev *dma;
+    dma_tube tube;
+    dma_tube_config cfg;
+
+    if (!dev->tx_dma_req) {
+        return 0;
+    }
+    if (dev->tx_dma_regs) {
+        return 1;
+    }
+    dma = usart_dma_dev(dev->tx_dma_req);
+    tube = (dma_tube)(dev->tx_dma_req & 0x7);
+
+    cfg.tube_src = wb->buf;
+    cfg.tube_src_size = DMA_SIZE_8BITS;
+    cfg.tube_dst = &regs->DR;
+    cfg.tube_dst_size = DMA_SIZE_8BITS;
+    cfg.tube_nr_xfers = 1;      /* set per span by usart_tx_dma_start() */
+    cfg.tube_flags = DMA_CFG_SRC_INC | DMA_CFG_CMPLT_IE;
+    cfg.target_data = NULL;
+    cfg.tube_req_src = dev->tx_dma_req;
+
+    /* Let the TXE interrupt drain anything already queued. */
+    while (!rb_is_empty(wb))
+        ;
+
+    dma_init(dma);
+    if (dma_tube_cfg(dma, tube, &cfg) != DMA_TUBE_CFG_SUCCESS) {
+        return 0;
+    }
+    dma_attach_interrupt(dma, tube, dev->tx_dma_handler);
+
+    dev->tx_dma_len = 0;
+    dev->tx_dma_regs = dma_tube_regs(dma, tube);
+    regs->CR3 |= USART_CR3_DMAT;
+    return 1;
+}
+
+/**
+ * @brief Stop transmitting by DMA and go back to TXE interrupts.
+ *
+ * Blocks until all queued data has been handed to the USART.
+ *
+ * @param dev Serial port to stop TX DMA on.
+ * @see usart_tx_dma_enable()
+ */
+void usart_tx_dma_disable(usart_dev *dev) {
+    usart_reg_map *regs = dev->regs;
+    dma_dev *dma;
+    dma_tube tube;
+
+    if (!dev->tx_dma_regs) {
+        return;
+    }
+    dma = usart_dma_dev(dev->tx_dma_req);
+    tube = (dma_tube)(dev->tx_dma_req & 0x7);
+
+    while (!rb_is_empty(dev->wb))
+        ;
+    regs->CR3 &= ~((uint32)USART_CR3_DMAT);
+    dma_disable(dma, tube);
+    dma_detach_interrupt(dma, tube);
+    dev->tx_dma_regs = NULL;
+}
+
 /**
  * @brief Call a function on each USART.
  * @param fn Function to call.
@@ -201,23 +465,23 @@ void usart_foreach(void (*fn)(usart_dev*)) {
  */
 
 __weak void __irq_usart1(void) {
-    usart_irq(&usart1_rb, &usart1_wb, USART1_BASE);
+    usart_irq(&usart1);
 }
 
 __weak void __irq_usart2(void) {
-    usart_irq(&usart2_rb, &usart2_wb, USART2_BASE);
+    usart_irq(&usart2);
 }
 
 __weak void __irq_usart3(void) {
-    usart_irq(&usart3_rb, &usart3_wb, USART3_BASE);
+    usart_irq(&usart3);
 }
 
 #ifdef STM32_HIGH_DENSITY
 __weak void __irq_uart4(void) {
-    usart_irq(&uart4_rb, &uart4_wb, UART4_BASE);
+    usart_irq(&uart4);
 }
 
 __weak void __irq_uart5(void) {
-    usart_irq(&uart5_rb, &uart5_wb, UART5_BASE);
+    usart_irq(&uart5);
 }
 #endif
@@ -68,6 +68,10 @@
 
 static void vcomDataTxCb(void);
 static void vcomDataRxCb(void);
+static int8 vcomStageTx(void);
+static int8 vcomStageTxFrom(const uint8 *buf, uint32 len);
+static void vcomReleaseTx(void);
+static void vcomReleaseRx(void);
 static uint8* vcomGetSetLineCoding(uint16);
 
 static void usbInit(void);
@@ -260,8 +264,17 @@ static ONE_DESCRIPTOR String_Descriptor[N_STRING_DESCRIPTORS] = {
 
 /* I/O state */
 
+/* The buffer sizes can be overridden from the build flags, e.g.
+ * -DCDC_SERIAL_TX_BUFFER_SIZE=1024. Both must be powers of 2, and
+ * large enough to hold a couple of packets. */
+#ifndef CDC_SERIAL_RX_BUFFER_SIZE
 #define CDC_SERIAL_RX_BUFFER_SIZE	256 // must be power of 2
+#endif
 #define CDC_SERIAL_RX_BUFFER_SIZE_MASK (CDC_SERIAL_RX_BUFFER_SIZE-1)
+#if (CDC_SERIAL_RX_BUFFER_SIZE & CDC_SERIAL_RX_BUFFER_SIZE_MASK) || \
+    (CDC_SERIAL_RX_BUFFER_SIZE < 4 * USB_CDCACM_RX_EPSIZE)
+#error "CDC_SERIAL_RX_BUFFER_SIZE must be a power of 2, at least 4 packets"
+#endif
 
 /* Received data */
 static volatile uint8 vcomBufferRx[CDC_SERIAL_RX_BUFFER_SIZE];
@@ -269,9 +282,17 @@ static volatile uint8 vcomBufferRx[CDC_SERIAL_RX_BUFFER_SIZE];
 static volatile uint32 rx_head;
 /* Read index from vcomBufferRx */
 static volatile uint32 rx_tail;
+/* Set when the RX endpoint was left NAKing for lack of room */
+static volatile uint8 rx_held;
 
+#ifndef CDC_SERIAL_TX_BUFFER_SIZE
 #define CDC_SERIAL_TX_BUFFER_SIZE	256 // must be power of 2
+#endif
 #define CDC_SERIAL_TX_BUFFER_SIZE_MASK (CDC_SERIAL_TX_BUFFER_SIZE-1)
+#if (CDC_SERIAL_TX_BUFFER_SIZE & CDC_SERIAL_TX_BUFFER_SIZE_MASK) || \
+    (CDC_SERIAL_TX_BUFFER_SIZE < 2 * USB_CDCACM_TX_EPSIZE)
+#error "CDC_SERIAL_TX_BUFFER_SIZE must be a power of 2, at least 2 packets"
+#endif
 // Tx data
 static volatile uint8 vcomBufferTx[CDC_SERIAL_TX_BUFFER_SIZE];
 // Write index to vcomBufferTx
@@ -280,6 +301,8 @@ static volatile uint32 tx_head;
 static volatile uint32 tx_tail;
 // Are we currently sending an IN packet?
 static volatile int8 transmitting;
+// Length of the packet staged in the second IN buffer, or -1 if none
+static volatile int8 tx_staged;
 
 
 
@@ -439,14 +462,53 @@ uint32 usb_cdcacm_tx(const uint8* buf, uint32 len)
 	}
 	tx_head = head; // store volatile variable
 
-	if (transmitting<0) {
-		vcomDataTxCb(); // initiate data transmission
+	/* Start sending if the endpoint is idle, otherwise get the next
+	 * packet into the spare IN buffer while the current one goes
+	 * out. Keep the USB interrupt off so this can't race with
+	 * vcomDataTxCb(). */
+	if (transmitting<0 || tx_staged<0) {
+		nvic_irq_disable(NVIC_USB_LP_CAN_RX0);
+		if (transmitting<0) {
+			vcomDataTxCb(); // initiate data transmission
+		} else if (tx_staged<0) {
+			tx_staged = vcomStageTx();
+		}
+		nvic_irq_enable(NVIC_USB_LP_CAN_RX0);
 	}
 
     return len;
 }
 
+/* This function is non-blocking.
+ *
+ * It copies whole packets from a user buffer straight into the IN
+ * packet buffers that are free, skipping vcomBufferTx, and returns
+ * the number of bytes copied (a multiple of USB_CDCACM_TX_EPSIZE).
+ * Nothing is copied while vcomBufferTx still holds unsent data, so
+ * the byte order is kept. */
+uint32 usb_cdcacm_tx_direct(const uint8* buf, uint32 len)
+{
+	uint32 sent = 0;
+
+	if (usb_cdcacm_get_pending()) return 0;
+
+	nvic_irq_disable(NVIC_USB_LP_CAN_RX0);
+	while (len - sent >= USB_CDCACM_TX_EPSIZE) {
+		if (transmitting<0) {
+			vcomStageTxFrom(buf + sent, USB_CDCACM_TX_EPSIZE);
+			transmitting = 1;
+			vcomReleaseTx();
+		} else if (tx_staged<0) {
+			tx_staged = vcomStageTxFrom(buf + sent, USB_CDCACM_TX_EPSIZE);
+		} else {
+			break; // both packet buffers are busy
+		}
+		sent += USB_CDCACM_TX_EPSIZE;
+	}
+	nvic_irq_enable(NVIC_USB_LP_CAN_RX0);
 
+	return sent;
+}
 
 uint32 usb_cdcacm_data_available(void) {
     return (rx_head - rx_tail) & CDC_SERIAL_RX_BUFFER_SIZE_MASK;
@@ -480,9 +542,12 @@ uint32 usb_cdcacm_rx(uint8* buf, uint32 len)
 	rx_tail = tail; // store volatile variable
 
 	uint32 rx_unread = (rx_head - tail) & CDC_SERIAL_RX_BUFFER_SIZE_MASK;
-    // If buffer was emptied to a pre-set value, re-enable the RX endpoint
-    if ( rx_unread <= 64 ) { // experimental value, gives the best performance
-        usb_set_ep_rx_stat(USB_CDCACM_RX_ENDP, USB_EP_STAT_RX_VALID);
+    // If buffer was emptied to a pre-set value, re-enable the RX endpoint.
+    // The endpoint is NAKing while rx_held is set, so vcomDataRxCb()
+    // can't run underneath us here.
+    if ( rx_held && rx_unread <= 64 ) { // experimental value, gives the best performance
+        rx_held = 0;
+        vcomReleaseRx();
 	}
     return n_copied;
 }
@@ -570,22 +635,29 @@ int usb_cdcacm_get_n_data_bits(void) {
 
 /*
  * Callbacks
+ *
+ * Both data endpoints are double-buffered. The USB peripheral picks
+ * the packet buffer it uses with the endpoint's DTOG bit, and the
+ * application hands buffers over by toggling SW_BUF. While the two
+ * bits are equal the endpoint NAKs, so for each endpoint one buffer
+ * is always ours to fill (IN) or empty (OUT) while the peripheral
+ * works on the other.
  */
-static void vcomDataTxCb(void)
+
+/* Copy up to one packet from vcomBufferTx into the IN buffer we own,
+ * and return its length. A zero-length packet is staged when there's
+ * nothing to send. */
+static int8 vcomStageTx(void)
 {
 	uint32 tail = tx_tail; // load volatile variable
 	uint32 tx_unsent = (tx_head - tail) & CDC_SERIAL_TX_BUFFER_SIZE_MASK;
-	if (tx_unsent==0) {
-		if ( (--transmitting)==0) goto flush; // no more data to send
-		return; // it was already flushed, keep Tx endpoint disabled
-	}
-	transmitting = 1;
     // We can only send up to USB_CDCACM_TX_EPSIZE bytes in the endpoint.
     if (tx_unsent > USB_CDCACM_TX_EPSIZE) {
         tx_unsent = USB_CDCACM_TX_EPSIZE;
     }
+	uint32 sw_buf = usb_get_ep_tx_sw_buf(USB_CDCACM_TX_ENDP);
 	// copy the bytes from USB Tx buffer to PMA buffer
-	uint32 *dst = usb_pma_ptr(USB_CDCACM_TX_ADDR);
+	uint32 *dst = usb_pma_ptr(sw_buf ? USB_CDCACM_TX_ADDR1 : USB_CDCACM_TX_ADDR);
     uint16 tmp = 0;
 	uint16 val;
 	uint32 i;
@@ -602,10 +674,74 @@ static void vcomDataTxCb(void)
         *dst = tmp;
     }
 	tx_tail = tail; // store volatile variable
-flush:
-	// enable Tx endpoint
-    usb_set_ep_tx_count(USB_CDCACM_TX_ENDP, tx_unsent);
-    usb_set_ep_tx_stat(USB_CDCACM_TX_ENDP, USB_EP_STAT_TX_VALID);
+	if (sw_buf) {
+		usb_set_ep_tx_buf1_count(USB_CDCACM_TX_ENDP, tx_unsent);
+	} else {
+		usb_set_ep_tx_buf0_count(USB_CDCACM_TX_ENDP, tx_unsent);
+	}
+	return tx_unsent;
+}
+
+/* Same as vcomStageTx(), but from a linear user buffer. len must not
+ * exceed USB_CDCACM_TX_EPSIZE. */
+static int8 vcomStageTxFrom(const uint8 *buf, uint32 len)
+{
+	uint32 sw_buf = usb_get_ep_tx_sw_buf(USB_CDCACM_TX_ENDP);
+	uint32 *dst = usb_pma_ptr(sw_buf ? USB_CDCACM_TX_ADDR1 : USB_CDCACM_TX_ADDR);
+	uint32 i;
+	for (i = 0; i + 1 < len; i += 2) {
+		*dst++ = buf[i] | (buf[i+1]<<8);
+	}
+	if ( len&1 ) {
+		*dst = buf[len-1];
+	}
+	if (sw_buf) {
+		usb_set_ep_tx_buf1_count(USB_CDCACM_TX_ENDP, len);
+	} else {
+		usb_set_ep_tx_buf0_count(USB_CDCACM_TX_ENDP, len);
+	}
+	return len;
+}
+
+/* Hand the staged IN buffer to the peripheral. */
+static void vcomReleaseTx(void)
+{
+	usb_toggle_ep_tx_sw_buf(USB_CDCACM_TX_ENDP);
+	usb_set_ep_tx_stat(USB_CDCACM_TX_ENDP, USB_EP_STAT_TX_VALID);
+}
+
+/* Hand the OUT buffer we've emptied back to the peripheral. */
+static void vcomReleaseRx(void)
+{
+	usb_toggle_ep_rx_sw_buf(USB_CDCACM_RX_ENDP);
+	usb_set_ep_rx_stat(USB_CDCACM_RX_ENDP, USB_EP_STAT_RX_VALID);
+}
+
+/* Called when an IN packet went out, or with the endpoint idle to
+ * start a transmission. */
+static void vcomDataTxCb(void)
+{
+	int8 len = tx_staged;
+	tx_staged = -1;
+	if (len<0) {
+		len = vcomStageTx();
+	}
+	if (len==0) {
+		// no more data to send; finish with one zero-length packet
+		if (transmitting<=0) {
+			transmitting = -1; // it was already flushed, keep Tx endpoint idle
+			return;
+		}
+		transmitting = 0;
+		vcomReleaseTx();
+		return;
+	}
+	transmitting = 1;
+	vcomReleaseTx();
+	// fill the other buffer while this packet goes out
+	if (usb_cdcacm_get_pending()) {
+		tx_staged = vcomStageTx();
+	}
 }
 
 
@@ -613,10 +749,23 @@ static void vcomDataRxCb(void)
 {
 	uint32 head = rx_head; // load volatile variable
 
-	uint32 ep_rx_size = usb_get_ep_rx_count(USB_CDCACM_RX_ENDP);
-	// This copy won't overwrite unread bytes as long as there is 
+	// The packet is in the buffer the peripheral just left, the one
+	// SW_BUF doesn't point at.
+	uint32 sw_buf = usb_get_ep_rx_sw_buf(USB_CDCACM_RX_ENDP);
+	uint32 ep_rx_size = sw_buf ? usb_get_ep_rx_buf0_count(USB_CDCACM_RX_ENDP) :
+	                             usb_get_ep_rx_buf1_count(USB_CDCACM_RX_ENDP);
+	uint32 *src = usb_pma_ptr(sw_buf ? USB_CDCACM_RX_ADDR : USB_CDCACM_RX_ADDR1);
+
+	uint32 rx_unread = (head - rx_tail + ep_rx_size) & CDC_SERIAL_RX_BUFFER_SIZE_MASK;
+	// If there will still be room for one more packet, let the peripheral
+	// receive it into the other buffer while we copy this one out.
+	// This copy won't overwrite unread bytes as long as there is
 	// enough room in the USB Rx buffer for next packet
-	uint32 *src = usb_pma_ptr(USB_CDCACM_RX_ADDR);
+	uint8 release = ( rx_unread < (CDC_SERIAL_RX_BUFFER_SIZE-USB_CDCACM_RX_EPSIZE) );
+	if (release) {
+		vcomReleaseRx();
+	}
+
     uint16 tmp = 0;
 	uint8 val;
 	uint32 i;
@@ -632,10 +781,9 @@ static void vcomDataRxCb(void)
 	}
 	rx_head = head; // store volatile variable
 
-	uint32 rx_unread = (head - rx_tail) & CDC_SERIAL_RX_BUFFER_SIZE_MASK;
-	// only enable further Rx if there is enough room to receive one more packet
-	if ( rx_unread < (CDC_SERIAL_RX_BUFFER_SIZE-USB_CDCACM_RX_EPSIZE) ) {
-		usb_set_ep_rx_stat(USB_CDCACM_RX_ENDP, USB_EP_STAT_RX_VALID);
+	// otherwise usb_cdcacm_rx() re-enables Rx once the buffer drains
+	if (!release) {
+		rx_held = 1;
 	}
 
     if (rx_hook) {
@@ -699,15 +847,31 @@ static void usbReset(void) {
 
     /* TODO figure out differences in style between RX/TX EP setup */
 
-    /* set up data endpoint OUT (RX) */
+    /* set up data endpoint OUT (RX), double-buffered. The peripheral
+     * starts on buffer 0 (DTOG_RX clear), and SW_BUF is set so that
+     * it can go ahead. */
     usb_set_ep_type(USB_CDCACM_RX_ENDP, USB_EP_EP_TYPE_BULK);
-    usb_set_ep_rx_addr(USB_CDCACM_RX_ENDP, USB_CDCACM_RX_ADDR);
-    usb_set_ep_rx_count(USB_CDCACM_RX_ENDP, USB_CDCACM_RX_EPSIZE);
+    usb_set_ep_kind(USB_CDCACM_RX_ENDP, USB_EP_EP_KIND_DBL_BUF);
+    usb_set_ep_rx_buf0_addr(USB_CDCACM_RX_ENDP, USB_CDCACM_RX_ADDR);
+    usb_set_ep_rx_buf1_addr(USB_CDCACM_RX_ENDP, USB_CDCACM_RX_ADDR1);
+    usb_set_ep_rx_buf0_count(USB_CDCACM_RX_ENDP, USB_CDCACM_RX_EPSIZE);
+    usb_set_ep_rx_buf1_count(USB_CDCACM_RX_ENDP, USB_CDCACM_RX_EPSIZE);
+    usb_clear_ep_dtog_rx(USB_CDCACM_RX_ENDP);
+    usb_set_ep_rx_sw_buf(USB_CDCACM_RX_ENDP);
     usb_set_ep_rx_stat(USB_CDCACM_RX_ENDP, USB_EP_STAT_RX_VALID);
+    usb_set_ep_tx_stat(USB_CDCACM_RX_ENDP, USB_EP_STAT_TX_DISABLED);
 
-    /* set up data endpoint IN (TX)  */
+    /* set up data endpoint IN (TX), double-buffered. DTOG_TX and
+     * SW_BUF both start clear, so nothing goes out until
+     * vcomDataTxCb() hands over the first buffer. */
     usb_set_ep_type(USB_CDCACM_TX_ENDP, USB_EP_EP_TYPE_BULK);
-    usb_set_ep_tx_addr(USB_CDCACM_TX_ENDP, USB_CDCACM_TX_ADDR);
+    usb_set_ep_kind(USB_CDCACM_TX_ENDP, USB_EP_EP_KIND_DBL_BUF);
+    usb_set_ep_tx_buf0_addr(USB_CDCACM_TX_ENDP, USB_CDCACM_TX_ADDR);
+    usb_set_ep_tx_buf1_addr(USB_CDCACM_TX_ENDP, USB_CDCACM_TX_ADDR1);
+    usb_set_ep_tx_buf0_count(USB_CDCACM_TX_ENDP, 0);
+    usb_set_ep_tx_buf1_count(USB_CDCACM_TX_ENDP, 0);
+    usb_clear_ep_dtog_tx(USB_CDCACM_TX_ENDP);
+    usb_clear_ep_tx_sw_buf(USB_CDCACM_TX_ENDP);
     usb_set_ep_tx_stat(USB_CDCACM_TX_ENDP, USB_EP_STAT_TX_NAK);
     usb_set_ep_rx_stat(USB_CDCACM_TX_ENDP, USB_EP_STAT_RX_DISABLED);
 
@@ -719,7 +883,9 @@ static void usbReset(void) {
 	rx_tail = 0;
 	tx_head = 0;
 	tx_tail = 0;
+    rx_held = 0;
     transmitting = -1;
+    tx_staged = -1;
 }
 
 static RESULT usbDataSetup(uint8 request) {
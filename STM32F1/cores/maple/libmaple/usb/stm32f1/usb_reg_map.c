@@ -76,12 +76,12 @@ static void usb_set_ep_rx_count_common(uint32 *rxc, uint16 count) {
         *rxc = (nblocks << 10) | (count & 0x3FF);
     }
 }
-/*
+
 void usb_set_ep_rx_buf0_count(uint8 ep, uint16 count) {
     uint32 *rxc = usb_ep_rx_buf0_count_ptr(ep);
     usb_set_ep_rx_count_common(rxc, count);
 }
-*/
+
 void usb_set_ep_rx_count(uint8 ep, uint16 count) {
     uint32 *rxc = usb_ep_rx_count_ptr(ep);
     usb_set_ep_rx_count_common(rxc, count);
@@ -128,9 +128,20 @@ size_t USBSerial::write(const uint8 *buf, uint32 len)
 
     uint32 txed = 0;
 	if (!_isBlocking) 	{
-		txed = usb_cdcacm_tx((const uint8*)buf + txed, len - txed);
+		// large writes skip the TX ring for as many packets as fit
+		if (len >= USB_CDCACM_TX_DIRECT_MIN) {
+			txed = usb_cdcacm_tx_direct((const uint8*)buf, len);
+		}
+		txed += usb_cdcacm_tx((const uint8*)buf + txed, len - txed);
 	}
 	else {
+		// whole packets go straight to packet memory as the endpoint
+		// buffers free up, the remainder through the TX ring
+		if (len >= USB_CDCACM_TX_DIRECT_MIN) {
+			while (len - txed >= USB_CDCACM_TX_EPSIZE) {
+				txed += usb_cdcacm_tx_direct((const uint8*)buf + txed, len - txed);
+			}
+		}
 		while (txed < len) {
 			txed += usb_cdcacm_tx((const uint8*)buf + txed, len - txed);
 		}
@@ -0,0 +1,91 @@
+/*
+ Ring Buffer Benchmark
+
+ Compares the libmaple C ring buffer (rb_* functions, used by the
+ hardware serial ports) with the lock-free RingBuffer<T, N> template,
+ for single items and for blocks.
+
+ Open the serial monitor to see the results, in microseconds per
+ pass of ITERATIONS operations.
+
+ This example code is in the public domain.
+ */
+
+#include <RingBuffer.h>
+#include <libmaple/ring_buffer.h>
+
+#define ITERATIONS 100000
+#define BLOCK      48
+
+static uint8 rbStorage[64];
+static ring_buffer rb;
+static RingBuffer<uint8, 64> ringBuffer;
+static uint8 block[BLOCK];
+volatile uint32 sink;
+
+uint32 benchRbSingle() {
+  uint32 sum = 0;
+  uint32 start = micros();
+  for (uint32 i = 0; i < ITERATIONS; i++) {
+    rb_insert(&rb, (uint8)i);
+    rb_insert(&rb, (uint8)(i >> 8));
+    sum += rb_remove(&rb);
+    sum += rb_remove(&rb);
+  }
+  uint32 elapsed = micros() - start;
+  sink = sum;
+  return elapsed;
+}
+
+uint32 benchTemplateSingle() {
+  uint32 sum = 0;
+  uint8 item;
+  uint32 start = micros();
+  for (uint32 i = 0; i < ITERATIONS; i++) {
+    ringBuffer.push((uint8)i);
+    ringBuffer.push((uint8)(i >> 8));
+    ringBuffer.pop(item);
+    sum += item;
+    ringBuffer.pop(item);
+    sum += item;
+  }
+  uint32 elapsed = micros() - start;
+  sink = sum;
+  return elapsed;
+}
+
+uint32 benchRbBlock() {
+  uint32 start = micros();
+  for (uint32 i = 0; i < ITERATIONS / BLOCK; i++) {
+    rb_write_block(&rb, block, BLOCK);
+    rb_read_block(&rb, block, BLOCK);
+  }
+  return micros() - start;
+}
+
+uint32 benchTemplateBlock() {
+  uint32 start = micros();
+  for (uint32 i = 0; i < ITERATIONS / BLOCK; i++) {
+    ringBuffer.write(block, BLOCK);
+    ringBuffer.read(block, BLOCK);
+  }
+  return micros() - start;
+}
+
+void setup() {
+  Serial.begin(115200);
+  rb_init(&rb, sizeof(rbStorage), rbStorage);
+}
+
+void loop() {
+  Serial.print("rb_insert/rb_remove:         ");
+  Serial.println(benchRbSingle());
+  Serial.print("RingBuffer push/pop:         ");
+  Serial.println(benchTemplateSingle());
+  Serial.print("rb_write_block/rb_read_block: ");
+  Serial.println(benchRbBlock());
+  Serial.print("RingBuffer write/read:       ");
+  Serial.println(benchTemplateBlock());
+  Serial.println();
+  delay(2000);
+}
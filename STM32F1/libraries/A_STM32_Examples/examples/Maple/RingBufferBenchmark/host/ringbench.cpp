@@ -0,0 +1,114 @@
+/*
+ * Host side of the RingBufferBenchmark example: runs the same comparison
+ * between the libmaple C ring buffer (rb_* functions) and the lock-free
+ * RingBuffer<T, N> template on the build machine, so changes to either can
+ * be timed without a board. Numbers are only comparable with each other,
+ * not with the ones the sketch prints.
+ *
+ * Build from this directory:
+ *   g++ -O2 -o ringbench ringbench.cpp -I../../../../../../cores/maple \
+ *       -I../../../../../../system/libmaple/include
+ *
+ * Usage: ringbench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <RingBuffer.h>
+#include <libmaple/ring_buffer.h>
+
+#define DEFAULT_ITERATIONS 10000000
+#define BLOCK              48
+
+static uint8 rbStorage[64];
+static ring_buffer rb;
+static RingBuffer<uint8, 64> ringBuffer;
+static uint8 block[BLOCK];
+static uint32 iterations = DEFAULT_ITERATIONS;
+volatile uint32 sink;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+__attribute__((noinline)) static double benchRbSingle(void) {
+    uint32 sum = 0;
+    double start = now();
+    for (uint32 i = 0; i < iterations; i++) {
+        rb_insert(&rb, (uint8)i);
+        rb_insert(&rb, (uint8)(i >> 8));
+        sum += rb_remove(&rb);
+        sum += rb_remove(&rb);
+    }
+    double elapsed = now() - start;
+    sink = sum;
+    return elapsed;
+}
+
+__attribute__((noinline)) static double benchTemplateSingle(void) {
+    uint32 sum = 0;
+    uint8 item = 0;
+    double start = now();
+    for (uint32 i = 0; i < iterations; i++) {
+        ringBuffer.push((uint8)i);
+        ringBuffer.push((uint8)(i >> 8));
+        ringBuffer.pop(item);
+        sum += item;
+        ringBuffer.pop(item);
+        sum += item;
+    }
+    double elapsed = now() - start;
+    sink = sum;
+    return elapsed;
+}
+
+__attribute__((noinline)) static double benchRbBlock(void) {
+    double start = now();
+    for (uint32 i = 0; i < iterations / BLOCK; i++) {
+        rb_write_block(&rb, block, BLOCK);
+        rb_read_block(&rb, block, BLOCK);
+    }
+    double elapsed = now() - start;
+    sink = block[0];
+    return elapsed;
+}
+
+__attribute__((noinline)) static double benchTemplateBlock(void) {
+    double start = now();
+    for (uint32 i = 0; i < iterations / BLOCK; i++) {
+        ringBuffer.write(block, BLOCK);
+        ringBuffer.read(block, BLOCK);
+    }
+    double elapsed = now() - start;
+    sink = block[0];
+    return elapsed;
+}
+
+static void report(const char *name, double seconds, uint32 ops) {
+    printf("%-30s %8.3f ms  %6.2f ns/op\n", name, seconds * 1e3,
+           seconds * 1e9 / ops);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1)
+        iterations = strtoul(argv[1], NULL, 0);
+    if (iterations < BLOCK) {
+        fprintf(stderr, "iterations must be at least %d\n", BLOCK);
+        return 1;
+    }
+
+    rb_init(&rb, sizeof(rbStorage), rbStorage);
+    for (uint32 i = 0; i < BLOCK; i++)
+        block[i] = (uint8)i;
+
+    uint32 blockOps = (iterations / BLOCK) * BLOCK * 2;
+    report("rb_insert/rb_remove:", benchRbSingle(), iterations * 4);
+    report("RingBuffer push/pop:", benchTemplateSingle(), iterations * 4);
+    report("rb_write_block/rb_read_block:", benchRbBlock(), blockOps);
+    report("RingBuffer write/read:", benchTemplateBlock(), blockOps);
+    return 0;
+}
@@ -1305,3 +1305,100 @@ bool SdioCard::writeStop()
     return trxStop();
     //Serial.println("writeStop.");
 }
+//=============================================================================
+// Split-phase transfers
+static SdioCard* m_asyncCard = 0;
+static size_t m_asyncBlocks = 0; // blocks in flight, 0 if none
+/*---------------------------------------------------------------------------*/
+bool sdioReadBlocksStart(SdioCard* card, uint32_t lba, uint8_t* buf, size_t n)
+{
+  if (!sdioFinish()) {
+    return false;
+  }
+  if ((3 & (uint32_t)buf) || n == 0) {
+    return sdError(SD_CARD_ERROR_DMA);
+  }
+  if (m_curState != READ_STATE || m_curLba != lba) {
+    if (!card->syncBlocks()) {
+      return false;
+    }
+    m_limitLba = (lba + 1024); //arbitrary limit
+    dmaTrxPrepare(buf, 512*n, TRX_RD);
+    dmaTrxStart(512*n, TRX_RD);
+    if ( !cardCommand(CMD18_XFERTYP, (m_highCapacity ? lba : 512*lba)) ) {
+      return sdError(SD_CARD_ERROR_CMD18);
+    }
+    m_curLba = lba;
+    m_curState = READ_STATE;
+  }
+  else {
+    dmaTrxPrepare(buf, 512*n, TRX_RD);
+    dmaTrxStart(512*n, TRX_RD);
+  }
+  m_asyncCard = card;
+  m_asyncBlocks = n;
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+bool sdioWriteBlocksStart(SdioCard* card, uint32_t lba, const uint8_t* buf, size_t n)
+{
+  if (!sdioFinish()) {
+    return false;
+  }
+  if ((3 & (uint32_t)buf) || n == 0) {
+    return sdError(SD_CARD_ERROR_DMA);
+  }
+  if (yieldTimeout(isBusyCMD13)) {
+    return sdError(SD_CARD_ERROR_CMD13);
+  }
+  if (m_curState != WRITE_STATE || m_curLba != lba) {
+    if (!card->syncBlocks()) {
+      return false;
+    }
+    m_limitLba = (lba + 1024); //arbitrary limit
+    dmaTrxPrepare((uint8_t *)buf, 512*n, TRX_WR);
+    if ( !cardCommand(CMD25_XFERTYP, (m_highCapacity ? lba : 512*lba)) ) {
+      return sdError(SD_CARD_ERROR_CMD25);
+    }
+    m_curLba = lba;
+    m_curState = WRITE_STATE;
+  }
+  else {
+    dmaTrxPrepare((uint8_t *)buf, 512*n, TRX_WR);
+  }
+  dmaTrxStart(512*n, TRX_WR);
+  m_asyncCard = card;
+  m_asyncBlocks = n;
+  return true;
+}
+/*---------------------------------------------------------------------------*/
+bool sdioFinish(void)
+{
+  size_t n = m_asyncBlocks;
+  if (n == 0) {
+    return true;
+  }
+  m_asyncBlocks = 0;
+  bool reading = (m_curState == READ_STATE);
+
+  if (!dmaTrxEnd(0)) {
+    if (reading) {
+      m_readErrors++;
+      m_asyncCard->syncBlocks();
+    } else {
+      m_writeErrors++;
+      m_curState = IDLE_STATE;
+    }
+    return false;
+  }
+  if (reading) {
+    m_totalReadLbas += n;
+  } else {
+    m_totalWriteLbas += n;
+  }
+  m_curLba += n;
+  if (m_curLba >= m_limitLba) {
+    m_asyncCard->syncBlocks();
+  }
+  return true;
+}
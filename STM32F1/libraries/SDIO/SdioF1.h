@@ -4,4 +4,13 @@
 
 #include <SdFat.h>
 
+// Split-phase versions of SdioCard::readBlocks() and writeBlocks(). The
+// start functions set up the SDIO DMA and return while it runs, so the
+// caller can get on with something else, e.g. feeding USB. Call
+// sdioFinish() before touching the buffer or the card again; it returns
+// false if the transfer failed. buf must be 4-byte aligned.
+bool sdioReadBlocksStart(SdioCard* card, uint32_t lba, uint8_t* buf, size_t n);
+bool sdioWriteBlocksStart(SdioCard* card, uint32_t lba, const uint8_t* buf, size_t n);
+bool sdioFinish(void);
+
 #endif
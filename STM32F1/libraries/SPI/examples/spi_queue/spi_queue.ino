@@ -0,0 +1,66 @@
+/**
+    SPI job queue example
+
+    Two devices share SPI_1: a sensor that is read continuously, and a
+    display that gets a new frame from time to time. Each job carries its
+    own settings and chip select, and the DMA interrupt runs them back to
+    back, so the main loop only looks at the results.
+
+    SCK   <-->  PA5
+    MISO  <-->  PA6
+    MOSI  <-->  PA7
+    Sensor CS   <-->  PA4
+    Display CS  <-->  PB0
+*/
+
+#include <SPI.h>
+
+#define SENSOR_CS_PIN  PA4
+#define DISPLAY_CS_PIN PB0
+
+uint8 sensorCommand[7] = { 0x80 | 0x28 }; // read 6 bytes from register 0x28
+uint8 sensorReply[7];
+volatile uint32 sensorReads = 0;
+
+uint8 frame[1024];
+volatile bool frameSent = true;
+
+void sensorDone(SPIJob *job);
+void frameDone(SPIJob *job) { frameSent = true; }
+
+SPIJob sensorJob = { SPISettings(1000000, MSBFIRST, SPI_MODE3), SENSOR_CS_PIN,
+                     sensorCommand, sensorReply, sizeof(sensorReply), sensorDone };
+SPIJob frameJob = { SPISettings(18000000, MSBFIRST, SPI_MODE0), DISPLAY_CS_PIN,
+                    frame, NULL, sizeof(frame), frameDone };
+
+// called from the DMA interrupt: read the sensor again straight away
+void sensorDone(SPIJob *job) {
+  sensorReads++;
+  SPI.queueTransfer(job);
+}
+
+void setup() {
+  Serial.begin(115200);
+  pinMode(SENSOR_CS_PIN, OUTPUT);
+  digitalWrite(SENSOR_CS_PIN, HIGH);
+  pinMode(DISPLAY_CS_PIN, OUTPUT);
+  digitalWrite(DISPLAY_CS_PIN, HIGH);
+  SPI.begin();
+  SPI.queueTransfer(&sensorJob);
+}
+
+void loop() {
+  static uint32 last = 0;
+  if (frameSent && millis() - last >= 40) {
+    last = millis();
+    for (uint32 i = 0; i < sizeof(frame); i++) frame[i] = i + last;
+    frameSent = false;
+    SPI.queueTransfer(&frameJob);
+  }
+  static uint32 report = 0;
+  if (millis() - report >= 1000) {
+    report = millis();
+    Serial.print("sensor reads: ");
+    Serial.println(sensorReads);
+  }
+}
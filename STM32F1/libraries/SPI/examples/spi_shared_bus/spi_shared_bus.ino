@@ -0,0 +1,49 @@
+/**
+    Shared SPI bus example
+
+    Two devices with different settings on SPI_1. Each is set up once with
+    addDevice(); after that, beginTransaction(device) only rewrites CR1 when
+    the other device was used last, and takes care of the chip select.
+
+    SCK   <-->  PA5
+    MISO  <-->  PA6
+    MOSI  <-->  PA7
+    Flash CS   <-->  PA4
+    Sensor CS  <-->  PB0
+*/
+
+#include <SPI.h>
+
+SPIDevice flash;
+SPIDevice sensor;
+
+void setup() {
+  Serial.begin(115200);
+  SPI.begin();
+  SPI.addDevice(flash, PA4, SPISettings(18000000, MSBFIRST, SPI_MODE0));
+  SPI.addDevice(sensor, PB0, SPISettings(1000000, MSBFIRST, SPI_MODE3));
+}
+
+uint8 readSensorId() {
+  SPI.beginTransaction(sensor);
+  SPI.transfer(0x80 | 0x0F); // read WHO_AM_I
+  uint8 id = SPI.transfer(0);
+  SPI.endTransaction(sensor);
+  return id;
+}
+
+uint32 readFlashId() {
+  uint8 id[4] = { 0x9F };
+  SPI.beginTransaction(flash);
+  SPI.transfer(id, sizeof(id));
+  SPI.endTransaction(flash);
+  return (id[1] << 16) | (id[2] << 8) | id[3];
+}
+
+void loop() {
+  Serial.print("flash JEDEC id: ");
+  Serial.print(readFlashId(), HEX);
+  Serial.print(", sensor id: ");
+  Serial.println(readSensorId(), HEX);
+  delay(1000);
+}
@@ -0,0 +1,72 @@
+// SPI slave frame receiver example
+// STM32 acts as a SPI slave on SPI1 and receives whole frames (everything
+// sent while NSS is low) by DMA into a pool of buffers. Each frame is
+// handed over when NSS goes high and printed from the main loop, which
+// then gives the buffer back. The master gets a status reply with every
+// frame: the number of frames received so far.
+//
+// NSS   <-->  PA4
+// SCK   <-->  PA5
+// MISO  <-->  PA6
+// MOSI  <-->  PA7
+
+#include <SPI.h>
+
+#define FRAME_SIZE 64
+#define BUFFERS    4
+
+uint8 pool[BUFFERS][FRAME_SIZE];
+uint32 reply[2]; // one can be updated while the other is being sent
+uint8 replyIndex = 0;
+
+volatile uint8 *ready[BUFFERS];
+volatile uint16 readyCount[BUFFERS];
+volatile uint8 readyHead = 0;
+uint8 readyTail = 0;
+volatile uint32 frames = 0;
+
+// called from the NSS interrupt
+void frameReceived(void *buffer, uint16 count) {
+  ready[readyHead % BUFFERS] = (uint8 *)buffer;
+  readyCount[readyHead % BUFFERS] = count;
+  readyHead++;
+  frames++;
+}
+
+void setup() {
+  Serial.begin(115200);
+  SPI.beginTransactionSlave(SPISettings(18000000, MSBFIRST, SPI_MODE0, DATA_SIZE_8BIT));
+  SPI.setSlaveReply(&reply[0], sizeof(reply[0]));
+  SPI.beginSlaveReceive(pool, FRAME_SIZE, BUFFERS, frameReceived);
+}
+
+void loop() {
+  while (readyTail != readyHead) {
+    uint8 *buffer = (uint8 *)ready[readyTail % BUFFERS];
+    uint16 count = readyCount[readyTail % BUFFERS];
+    readyTail++;
+
+    Serial.print(count);
+    Serial.print(" bytes:");
+    for (uint16 i = 0; i < count; i++) {
+      Serial.print(' ');
+      Serial.print(buffer[i], HEX);
+    }
+    Serial.println();
+    SPI.releaseSlaveBuffer(buffer);
+  }
+
+  // the reply is picked up at the start of the next frame
+  uint32 n = frames;
+  if (n != reply[replyIndex]) {
+    replyIndex ^= 1;
+    reply[replyIndex] = n;
+    SPI.setSlaveReply(&reply[replyIndex], sizeof(reply[0]));
+  }
+  static uint32 dropped = 0;
+  if (SPI.slaveFramesDropped() != dropped) {
+    dropped = SPI.slaveFramesDropped();
+    Serial.print("dropped: ");
+    Serial.println(dropped);
+  }
+}
@@ -0,0 +1,44 @@
+/**
+    SPI streaming example
+
+    Reads 16 bit samples from a free-running serial ADC continuously: the
+    DMA fills one half of the buffer while the other half, just filled, is
+    averaged in the callback. Nothing stops between blocks, so no sample
+    is lost.
+
+    SCK   <-->  PA5
+    MISO  <-->  PA6
+    MOSI  <-->  PA7
+*/
+
+#include <SPI.h>
+
+#define SAMPLES 512
+
+uint16 samples[SAMPLES];
+volatile uint32 average;
+volatile uint32 blocks = 0;
+
+// called from the DMA interrupt with the half that was just filled
+void halfDone(void *rx, void *tx, uint16 count) {
+  uint16 *s = (uint16 *)rx;
+  uint32 sum = 0;
+  for (uint16 i = 0; i < count; i++) sum += s[i];
+  average = sum / count;
+  blocks++;
+}
+
+void setup() {
+  Serial.begin(115200);
+  SPI.begin();
+  SPI.setDataSize(DATA_SIZE_16BIT);
+  SPI.setClockDivider(SPI_CLOCK_DIV8); // 9 MHz
+  SPI.beginStream(samples, NULL, SAMPLES, halfDone);
+}
+
+void loop() {
+  Serial.print(blocks);
+  Serial.print(" blocks, average ");
+  Serial.println(average);
+  delay(1000);
+}
@@ -62,6 +62,8 @@ static void configure_gpios(spi_dev *dev, bool as_master);
 static spi_baud_rate determine_baud_rate(spi_dev *dev, uint32_t freq);
 
 static uint16_t ff = 0XFFFF;
+static const uint16_t spi_job_fill = 0xFFFF; // sent by queued jobs without a TX buffer
+static uint16_t spi_job_sink;                // received into by jobs without an RX buffer
 
 #if (BOARD_NR_SPI >= 3) && !defined(STM32_HIGH_DENSITY)
 #error "The SPI library is misconfigured: 3 SPI ports only available on high density STM32 devices"
@@ -273,6 +275,13 @@ If someone finds this is not the case or sees a logic error with this let me kno
 void SPIClass::beginTransaction(uint8_t pin, SPISettings settings)
 {
 	(void)pin; // unused
+    if (_currentSetting->lockHook) _currentSetting->lockHook(_currentSetting->lockArg);
+    spi_reg_map * regs = _currentSetting->spi_d->regs;
+    if (_currentSetting->state == SPI_STATE_READY && (regs->CR1 & (SPI_CR1_MSTR | SPI_CR1_SPE)) == (SPI_CR1_MSTR | SPI_CR1_SPE)) {
+        // already running as master: only change what differs
+        applyCR1(_currentSetting, masterCR1(settings, determine_baud_rate(_currentSetting->spi_d, settings.clock)));
+        return;
+    }
     setBitOrder(settings.bitOrder);
     setDataMode(settings.dataMode);
     setDataSize(settings.dataSize);
@@ -280,8 +289,72 @@ void SPIClass::beginTransaction(uint8_t pin, SPISettings settings)
     begin();
 }
 
+/*
+ * Devices on a shared bus
+ */
+
+// CR1 of an enabled master running with these settings
+uint32 SPIClass::masterCR1(const SPISettings &settings, uint32 clockDivider)
+{
+    return SPI_CR1_SPE | SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI
+        | (clockDivider & SPI_CR1_BR)
+        | (settings.bitOrder == LSBFIRST ? SPI_CR1_LSBFIRST : 0)
+        | (settings.dataSize & SPI_CR1_DFF)
+        | (settings.dataMode & (SPI_CR1_CPOL | SPI_CR1_CPHA));
+}
+
+// Switches the port to cr1: nothing if it's already there, otherwise one
+// write, or two if the frame size changes.
+void SPIClass::applyCR1(SPISettings * port, uint32 cr1)
+{
+    spi_reg_map * regs = port->spi_d->regs;
+    uint32 old = regs->CR1;
+    if (old == cr1) return;
+
+    while (regs->SR & SPI_SR_BSY);
+    if ((old ^ cr1) & SPI_CR1_DFF) {
+        regs->CR1 = old & ~SPI_CR1_SPE; // DFF must only be changed with the SPI disabled
+    }
+    regs->CR1 = cr1;
+    port->clockDivider = cr1 & SPI_CR1_BR;
+    port->bitOrder = (cr1 & SPI_CR1_LSBFIRST) ? LSBFIRST : MSBFIRST;
+    port->dataMode = cr1 & (SPI_CR1_CPOL | SPI_CR1_CPHA);
+    port->dataSize = cr1 & SPI_CR1_DFF;
+}
+
+void SPIClass::addDevice(SPIDevice &device, uint8 csPin, const SPISettings &settings)
+{
+    device.cr1 = masterCR1(settings, determine_baud_rate(_currentSetting->spi_d, settings.clock));
+    device.csPin = csPin;
+    device.port = _currentSetting - _settings;
+    if (csPin != SPI_NO_CS) {
+        digitalWrite(csPin, HIGH);
+        pinMode(csPin, OUTPUT);
+    }
+}
+
+void SPIClass::beginTransaction(SPIDevice &device)
+{
+    _currentSetting = &_settings[device.port];
+    if (_currentSetting->lockHook) _currentSetting->lockHook(_currentSetting->lockArg);
+    applyCR1(_currentSetting, device.cr1);
+    if (device.csPin != SPI_NO_CS) {
+        gpio_write_bit(PIN_MAP[device.csPin].gpio_device, PIN_MAP[device.csPin].gpio_bit, 0);
+    }
+}
+
+void SPIClass::endTransaction(SPIDevice &device)
+{
+    if (device.csPin != SPI_NO_CS) {
+        gpio_write_bit(PIN_MAP[device.csPin].gpio_device, PIN_MAP[device.csPin].gpio_bit, 1);
+    }
+    SPISettings * port = &_settings[device.port];
+    if (port->unlockHook) port->unlockHook(port->lockArg);
+}
+
 void SPIClass::beginTransactionSlave(SPISettings settings)
 {
+    if (_currentSetting->lockHook) _currentSetting->lockHook(_currentSetting->lockArg);
     setBitOrder(settings.bitOrder);
     setDataMode(settings.dataMode);
     setDataSize(settings.dataSize);
@@ -290,6 +363,7 @@ void SPIClass::beginTransactionSlave(SPISettings settings)
 
 void SPIClass::endTransaction(void)
 {
+    if (_currentSetting->unlockHook) _currentSetting->unlockHook(_currentSetting->lockArg);
     //digitalWrite(_SSPin,HIGH);
 #if false
 // code from SAM core
@@ -321,6 +395,16 @@ uint16 SPIClass::read(void)
 void SPIClass::read(uint8 *buf, uint32 len)
 {
     if ( len == 0 ) return;
+    if ( _currentSetting->dataSize == DATA_SIZE_8BIT && useDma(len) ) {
+        uint32 chunk = dmaChunk();
+        while ( len ) {
+            uint32 n = (len < chunk) ? len : chunk;
+            if (dmaTransfer((uint16)0xFFFF, buf, n) != 0) return; // timed out
+            buf += n;
+            len -= n;
+        }
+        return;
+    }
     spi_rx_reg(_currentSetting->spi_d);		// clear the RX buffer in case a byte is waiting on it.
     spi_reg_map * regs = _currentSetting->spi_d->regs;
     // start sequence: write byte 0
@@ -372,6 +456,18 @@ void SPIClass::write(uint16 data, uint32 n)
 
 void SPIClass::write(const void *data, uint32 length)
 {
+    if ( useDma(length) && _currentSetting->transmitCallback == NULL ) {
+        uint32 chunk = dmaChunk();
+        uint32 frame = (_currentSetting->dataSize == DATA_SIZE_16BIT) ? 2 : 1;
+        const uint8 * p = (const uint8 *)data;
+        while ( length ) {
+            uint32 n = (length < chunk) ? length : chunk;
+            if (dmaSend(p, n) != 0) return; // timed out
+            p += n * frame;
+            length -= n;
+        }
+        return;
+    }
     spi_dev * spi_d = _currentSetting->spi_d;
     spi_tx(spi_d, data, length); // data can be array of bytes or words
     waitSpiTxEnd(spi_d); // "5. Wait until TXE=1 and then wait until BSY=0 before disabling the SPI."
@@ -404,6 +500,18 @@ uint16_t SPIClass::transfer16(uint16_t data) const
 void SPIClass::transfer(const uint8_t * tx_buf, uint8_t * rx_buf, uint32 len)
 {
     if ( len == 0 ) return;
+    if ( _currentSetting->dataSize == DATA_SIZE_8BIT && useDma(len) ) {
+        // also fine in place: the TX channel stays ahead of the RX one
+        uint32 chunk = dmaChunk();
+        while ( len ) {
+            uint32 n = (len < chunk) ? len : chunk;
+            if (dmaTransfer(tx_buf, rx_buf, n) != 0) return; // timed out
+            tx_buf += n;
+            rx_buf += n;
+            len -= n;
+        }
+        return;
+    }
     spi_rx_reg(_currentSetting->spi_d);      // clear the RX buffer in case a byte is waiting on it.
     spi_reg_map * regs = _currentSetting->spi_d->regs;
     // start sequence: write byte 0
@@ -464,9 +572,11 @@ uint8 SPIClass::dmaTransferRepeat(uint16 length) {
     //uint32_t m = millis();
     uint8 b = 0;
     uint32_t m = millis();
-    while ((dma_get_isr_bits(_currentSetting->spiDmaDev, _currentSetting->spiTxDmaChannel) & DMA_ISR_TCIF1)==0) {
+    // the RX channel finishes last, once the final frame has been read back
+    while ((dma_get_isr_bits(_currentSetting->spiDmaDev, _currentSetting->spiRxDmaChannel) & DMA_ISR_TCIF1)==0) {
         //Avoid interrupts and just loop waiting for the flag to be set.
         if ((millis() - m) > DMA_TIMEOUT) { b = 2; break; }
+        if (_currentSetting->dmaYield) yield();
     }
 
     waitSpiTxEnd(_currentSetting->spi_d);  // "5. Wait until TXE=1 and then wait until BSY=0 before disabling the SPI."
@@ -530,6 +640,7 @@ uint8 SPIClass::dmaSendRepeat(uint16 length) {
     while ((dma_get_isr_bits(_currentSetting->spiDmaDev, _currentSetting->spiTxDmaChannel) & DMA_ISR_TCIF1)==0) {
         //Avoid interrupts and just loop waiting for the flag to be set.
         if ((millis() - m) > DMA_TIMEOUT) { b = 2; break; }
+        if (_currentSetting->dmaYield) yield();
     }
     waitSpiTxEnd(_currentSetting->spi_d); // "5. Wait until TXE=1 and then wait until BSY=0 before disabling the SPI."
     spi_tx_dma_disable(_currentSetting->spi_d);
@@ -588,32 +699,48 @@ uint8 SPIClass::dmaSendAsync(const void * transmitBuf, uint16 length, bool minc)
 
 void SPIClass::onReceive(void(*callback)(void)) {
     _currentSetting->receiveCallback = callback;
+    if (_currentSetting->jobHead != NULL) {
+        return; // the job queue has the interrupt; it hands it back when done
+    }
     if (callback){
-        switch (_currentSetting->spi_d->clk_id) {
-            #if BOARD_NR_SPI >= 1
-        case RCC_SPI1:
-            dma_attach_interrupt(_currentSetting->spiDmaDev, _currentSetting->spiRxDmaChannel, &SPIClass::_spi1EventCallback);
-            break;
-            #endif
-            #if BOARD_NR_SPI >= 2
-        case RCC_SPI2:
-            dma_attach_interrupt(_currentSetting->spiDmaDev, _currentSetting->spiRxDmaChannel, &SPIClass::_spi2EventCallback);
-            break;
-            #endif
-            #if BOARD_NR_SPI >= 3
-        case RCC_SPI3:
-            dma_attach_interrupt(_currentSetting->spiDmaDev, _currentSetting->spiRxDmaChannel, &SPIClass::_spi3EventCallback);
-            break;
-            #endif
-        default:
-            ASSERT(0);
-        }
+        attachRxInterrupt(_currentSetting, RX_IRQ_EVENT);
     }
     else {
         dma_detach_interrupt(_currentSetting->spiDmaDev, _currentSetting->spiRxDmaChannel);
     }
 }
 
+void SPIClass::attachRxInterrupt(SPISettings * port, uint8 handler) {
+    switch (port->spi_d->clk_id) {
+        #if BOARD_NR_SPI >= 1
+    case RCC_SPI1: {
+        static void (* const handlers[])(void) = {
+            &SPIClass::_spi1EventCallback, &SPIClass::_spi1JobCallback, &SPIClass::_spi1StreamCallback };
+        dma_attach_interrupt(port->spiDmaDev, port->spiRxDmaChannel, handlers[handler]);
+        break;
+    }
+        #endif
+        #if BOARD_NR_SPI >= 2
+    case RCC_SPI2: {
+        static void (* const handlers[])(void) = {
+            &SPIClass::_spi2EventCallback, &SPIClass::_spi2JobCallback, &SPIClass::_spi2StreamCallback };
+        dma_attach_interrupt(port->spiDmaDev, port->spiRxDmaChannel, handlers[handler]);
+        break;
+    }
+        #endif
+        #if BOARD_NR_SPI >= 3
+    case RCC_SPI3: {
+        static void (* const handlers[])(void) = {
+            &SPIClass::_spi3EventCallback, &SPIClass::_spi3JobCallback, &SPIClass::_spi3StreamCallback };
+        dma_attach_interrupt(port->spiDmaDev, port->spiRxDmaChannel, handlers[handler]);
+        break;
+    }
+        #endif
+    default:
+        ASSERT(0);
+    }
+}
+
 void SPIClass::onTransmit(void(*callback)(void)) {
     _currentSetting->transmitCallback = callback;
     if (callback){
@@ -679,6 +806,394 @@ void SPIClass::EventCallback() {
     }
 }
 
+/*
+ * Automatic DMA for buffer transfers
+ */
+
+// The DMA channels are shared with other peripherals (e.g. SPI1 with USART3
+// and SPI2 with USART1), so they are only borrowed while nobody else has one
+// running or has a handler attached to it. Slave ports stay polled: the
+// master sets the pace, so there's no way to size the chunks or a timeout.
+static bool dma_channel_free(dma_dev * dev, dma_channel channel) {
+    return !dma_is_enabled(dev, channel) && dev->handlers[channel - 1].handler == NULL;
+}
+
+// Whether the port's channels can be taken for a job, stream or slave
+// receiver: idle, with no handler but the ones onReceive()/onTransmit()
+// attached for this port.
+bool SPIClass::dmaChannelsFree(SPISettings * port) {
+    dma_dev * dev = port->spiDmaDev;
+    if (dma_is_enabled(dev, port->spiRxDmaChannel) || dma_is_enabled(dev, port->spiTxDmaChannel)) return false;
+    return (port->receiveCallback || dev->handlers[port->spiRxDmaChannel - 1].handler == NULL)
+        && (port->transmitCallback || dev->handlers[port->spiTxDmaChannel - 1].handler == NULL);
+}
+
+bool SPIClass::useDma(uint32 length) {
+    SPISettings * s = _currentSetting;
+    return s->dmaThreshold != 0 && length >= s->dmaThreshold
+        && s->state == SPI_STATE_READY && s->receiveCallback == NULL
+        && (s->spi_d->regs->CR1 & SPI_CR1_MSTR)
+        && dma_channel_free(s->spiDmaDev, s->spiRxDmaChannel)
+        && dma_channel_free(s->spiDmaDev, s->spiTxDmaChannel);
+}
+
+// Frames per DMA transfer: what the 16 bit counter allows, but also no more
+// than goes out in half of DMA_TIMEOUT at the current clock, so that slow
+// clocks don't hit the timeout in dmaTransferRepeat() and dmaSendRepeat().
+uint32 SPIClass::dmaChunk(void) {
+    spi_dev * spi_d = _currentSetting->spi_d;
+    uint32 clock = (rcc_dev_clk(spi_d->clk_id) == RCC_APB2) ? STM32_PCLK2 : STM32_PCLK1;
+    clock >>= ((spi_d->regs->CR1 & SPI_CR1_BR) >> 3) + 1;
+    uint32 frames = clock / ((_currentSetting->dataSize == DATA_SIZE_16BIT) ? 16 : 8) / 1000 * DMA_TIMEOUT / 2;
+    return (frames > 0xFFFF) ? 0xFFFF : (frames ? frames : 1);
+}
+
+/*
+ * Queued transfers. The job at the head of the port's list is the one on
+ * the wire; everything else is picked up from the RX DMA interrupt.
+ */
+
+bool SPIClass::queueTransfer(SPIJob * job) {
+    SPISettings * port = _currentSetting;
+    if (job->length == 0 || port->state == SPI_STATE_IDLE || port->state == SPI_STATE_STREAM) return false;
+
+    // worked out here so that the interrupt only has to compare CR1
+    job->settings.clockDivider = determine_baud_rate(port->spi_d, job->settings.clock);
+    job->next = NULL;
+
+    noInterrupts();
+    bool start = (port->jobHead == NULL);
+    if (start && !dmaChannelsFree(port)) {
+        interrupts();
+        return false;
+    }
+    if (start) {
+        port->jobHead = job;
+    } else {
+        port->jobTail->next = job;
+    }
+    port->jobTail = job;
+    interrupts();
+
+    if (start) {
+        dma_init(port->spiDmaDev);
+        attachRxInterrupt(port, RX_IRQ_JOB);
+        port->state = SPI_STATE_TRANSFER;
+        startJob(port);
+    }
+    return true;
+}
+
+void SPIClass::startJob(SPISettings * port) {
+    SPIJob * job = port->jobHead;
+    SPISettings * s = &job->settings;
+    spi_reg_map * regs = port->spi_d->regs;
+
+    applyCR1(port, masterCR1(*s, s->clockDivider));
+
+    if (job->csPin != SPI_NO_CS) {
+        gpio_write_bit(PIN_MAP[job->csPin].gpio_device, PIN_MAP[job->csPin].gpio_bit, 0);
+    }
+
+    dma_xfer_size dma_bit_size = (s->dataSize==DATA_SIZE_16BIT) ? DMA_SIZE_16BITS : DMA_SIZE_8BITS;
+    if (job->rxBuf) {
+        dma_setup_transfer(port->spiDmaDev, port->spiRxDmaChannel, &regs->DR, dma_bit_size,
+                           job->rxBuf, dma_bit_size, (DMA_MINC_MODE | DMA_TRNS_CMPLT));
+    } else {
+        dma_setup_transfer(port->spiDmaDev, port->spiRxDmaChannel, &regs->DR, dma_bit_size,
+                           &spi_job_sink, dma_bit_size, DMA_TRNS_CMPLT);
+    }
+    if (job->txBuf) {
+        dma_setup_transfer(port->spiDmaDev, port->spiTxDmaChannel, &regs->DR, dma_bit_size,
+                           (volatile void*)job->txBuf, dma_bit_size, (DMA_MINC_MODE | DMA_FROM_MEM));
+    } else {
+        dma_setup_transfer(port->spiDmaDev, port->spiTxDmaChannel, &regs->DR, dma_bit_size,
+                           (volatile void*)&spi_job_fill, dma_bit_size, DMA_FROM_MEM);
+    }
+    dma_set_priority(port->spiDmaDev, port->spiTxDmaChannel, DMA_PRIORITY_LOW);
+    dma_set_priority(port->spiDmaDev, port->spiRxDmaChannel, DMA_PRIORITY_VERY_HIGH);
+    dma_set_num_transfers(port->spiDmaDev, port->spiRxDmaChannel, job->length);
+    dma_set_num_transfers(port->spiDmaDev, port->spiTxDmaChannel, job->length);
+
+    if (spi_is_rx_nonempty(port->spi_d) == 1) spi_rx_reg(port->spi_d);
+    dma_enable(port->spiDmaDev, port->spiRxDmaChannel);// enable receive
+    dma_enable(port->spiDmaDev, port->spiTxDmaChannel);// enable transmit
+    spi_rx_dma_enable(port->spi_d);
+    spi_tx_dma_enable(port->spi_d);
+}
+
+void SPIClass::JobCallback(SPISettings * port) {
+    SPIJob * job = port->jobHead;
+    // The next job may already have been started when the DMA IRQ
+    // handler clears the flags, so go by the transfer count instead.
+    if (job == NULL || dma_get_count(port->spiDmaDev, port->spiRxDmaChannel) != 0) {
+        return;
+    }
+
+    // the last frame is in, so the bus is quiet
+    spi_tx_dma_disable(port->spi_d);
+    spi_rx_dma_disable(port->spi_d);
+    dma_disable(port->spiDmaDev, port->spiTxDmaChannel);
+    dma_disable(port->spiDmaDev, port->spiRxDmaChannel);
+    if (job->csPin != SPI_NO_CS) {
+        gpio_write_bit(PIN_MAP[job->csPin].gpio_device, PIN_MAP[job->csPin].gpio_bit, 1);
+    }
+
+    port->jobHead = job->next;
+    if (port->jobHead != NULL) {
+        startJob(port);
+    } else {
+        port->state = SPI_STATE_READY;
+        if (port->receiveCallback) {
+            attachRxInterrupt(port, RX_IRQ_EVENT);
+        } else {
+            dma_detach_interrupt(port->spiDmaDev, port->spiRxDmaChannel);
+        }
+    }
+
+    if (job->callback) {
+        job->callback(job);
+    }
+}
+
+/*
+ * Continuous streaming: both channels run in circular mode, and only the
+ * RX channel interrupts, at half and full buffer.
+ */
+
+bool SPIClass::beginStream(void * rxBuf, void * txBuf, uint16 length, SPIStreamCallback callback) {
+    SPISettings * port = _currentSetting;
+    if (port->state != SPI_STATE_READY || rxBuf == NULL || length < 2 || (length & 1)) return false;
+    if (!dmaChannelsFree(port)) return false;
+
+    port->streamCallback = callback;
+    port->streamRx = rxBuf;
+    port->streamTx = txBuf;
+    port->streamLength = length;
+
+    dma_init(port->spiDmaDev);
+    dma_xfer_size dma_bit_size = (port->dataSize==DATA_SIZE_16BIT) ? DMA_SIZE_16BITS : DMA_SIZE_8BITS;
+    dma_setup_transfer(port->spiDmaDev, port->spiRxDmaChannel, &port->spi_d->regs->DR, dma_bit_size,
+                       rxBuf, dma_bit_size, (DMA_MINC_MODE | DMA_CIRC_MODE | DMA_HALF_TRNS | DMA_TRNS_CMPLT));
+    if (txBuf) {
+        dma_setup_transfer(port->spiDmaDev, port->spiTxDmaChannel, &port->spi_d->regs->DR, dma_bit_size,
+                           txBuf, dma_bit_size, (DMA_MINC_MODE | DMA_CIRC_MODE | DMA_FROM_MEM));
+    } else {
+        dma_setup_transfer(port->spiDmaDev, port->spiTxDmaChannel, &port->spi_d->regs->DR, dma_bit_size,
+                           (volatile void*)&spi_job_fill, dma_bit_size, (DMA_CIRC_MODE | DMA_FROM_MEM));
+    }
+    dma_set_priority(port->spiDmaDev, port->spiTxDmaChannel, DMA_PRIORITY_LOW);
+    dma_set_priority(port->spiDmaDev, port->spiRxDmaChannel, DMA_PRIORITY_VERY_HIGH);
+    dma_set_num_transfers(port->spiDmaDev, port->spiRxDmaChannel, length);
+    dma_set_num_transfers(port->spiDmaDev, port->spiTxDmaChannel, length);
+    attachRxInterrupt(port, RX_IRQ_STREAM);
+
+    port->state = SPI_STATE_STREAM;
+    if (spi_is_rx_nonempty(port->spi_d) == 1) spi_rx_reg(port->spi_d);
+    dma_enable(port->spiDmaDev, port->spiRxDmaChannel);// enable receive
+    dma_enable(port->spiDmaDev, port->spiTxDmaChannel);// enable transmit
+    spi_rx_dma_enable(port->spi_d);
+    spi_tx_dma_enable(port->spi_d);
+    return true;
+}
+
+void SPIClass::endStream(void) {
+    SPISettings * port = _currentSetting;
+    if (port->state != SPI_STATE_STREAM) return;
+
+    spi_tx_dma_disable(port->spi_d);
+    if (port->spi_d->regs->CR1 & SPI_CR1_MSTR) {
+        waitSpiTxEnd(port->spi_d); // let the frame in progress finish
+        spi_rx_dma_disable(port->spi_d);
+    } else {
+        // a slave's master may keep clocking, so BSY needn't ever clear;
+        // cut the frame off instead
+        spi_rx_dma_disable(port->spi_d);
+        spi_peripheral_disable(port->spi_d);
+        spi_peripheral_enable(port->spi_d);
+    }
+    dma_disable(port->spiDmaDev, port->spiTxDmaChannel);
+    dma_disable(port->spiDmaDev, port->spiRxDmaChannel);
+    dma_clear_isr_bits(port->spiDmaDev, port->spiRxDmaChannel);
+    dma_clear_isr_bits(port->spiDmaDev, port->spiTxDmaChannel);
+    if (spi_is_rx_nonempty(port->spi_d) == 1) spi_rx_reg(port->spi_d);
+
+    if (port->receiveCallback) {
+        attachRxInterrupt(port, RX_IRQ_EVENT);
+    } else {
+        dma_detach_interrupt(port->spiDmaDev, port->spiRxDmaChannel);
+    }
+    port->state = SPI_STATE_READY;
+}
+
+void SPIClass::StreamCallback(SPISettings * port) {
+    uint8 bits = dma_get_isr_bits(port->spiDmaDev, port->spiRxDmaChannel);
+    dma_clear_isr_bits(port->spiDmaDev, port->spiRxDmaChannel);
+    if (port->streamCallback == NULL) return;
+
+    uint16 half = port->streamLength / 2;
+    uint32 offset = (port->dataSize==DATA_SIZE_16BIT) ? 2 * half : half; // in bytes
+    uint8 * rx = (uint8 *)port->streamRx;
+    uint8 * tx = (uint8 *)port->streamTx;
+    // both are set if we got here late; the halves are still in order
+    if (bits & DMA_ISR_HTIF) {
+        port->streamCallback(rx, tx, half);
+    }
+    if (bits & DMA_ISR_TCIF) {
+        port->streamCallback(rx + offset, tx ? tx + offset : NULL, half);
+    }
+}
+
+/*
+ * Slave frame receiver. The only interrupt is the NSS rising edge; the DMA
+ * channels just run until then.
+ */
+
+bool SPIClass::beginSlaveReceive(void * pool, uint16 bufferSize, uint8 count, SPISlaveCallback callback) {
+    SPISettings * port = _currentSetting;
+    if (port->state != SPI_STATE_READY || pool == NULL || bufferSize == 0 || count == 0 || count > 32) return false;
+    if (!dmaChannelsFree(port)) return false;
+
+    port->slaveCallback = callback;
+    port->slavePool = (uint8 *)pool;
+    port->slaveSize = bufferSize;
+    port->slaveFree = (count == 32) ? 0xFFFFFFFF : ((1UL << count) - 1);
+    port->slaveCurrent = -1;
+    port->slaveDropped = 0;
+
+    dma_init(port->spiDmaDev);
+    port->state = SPI_STATE_RECEIVE;
+    noInterrupts();
+    slaveArm(port);
+    slaveRestart(port);
+    interrupts();
+    ::attachInterrupt(nssPin(), &SPIClass::slaveNssEvent, port, RISING);
+    return true;
+}
+
+void SPIClass::endSlaveReceive(void) {
+    SPISettings * port = _currentSetting;
+    if (port->state != SPI_STATE_RECEIVE) return;
+
+    ::detachInterrupt(nssPin());
+    spi_rx_dma_disable(port->spi_d);
+    spi_tx_dma_disable(port->spi_d);
+    dma_disable(port->spiDmaDev, port->spiRxDmaChannel);
+    dma_disable(port->spiDmaDev, port->spiTxDmaChannel);
+    port->state = SPI_STATE_READY;
+}
+
+void SPIClass::releaseSlaveBuffer(void * buffer) {
+    SPISettings * port = _currentSetting;
+    uint32 frame = (port->dataSize==DATA_SIZE_16BIT) ? 2 : 1;
+    uint32 i = ((uint8 *)buffer - port->slavePool) / (port->slaveSize * frame);
+
+    noInterrupts();
+    port->slaveFree |= (1UL << i);
+    if (port->state == SPI_STATE_RECEIVE && port->slaveCurrent < 0) {
+        // we were dropping frames; start again unless one is under way
+        const stm32_pin_info * nss = &PIN_MAP[nssPin()];
+        if (gpio_read_bit(nss->gpio_device, nss->gpio_bit)) {
+            slaveArm(port);
+            slaveRestart(port);
+        }
+    }
+    interrupts();
+}
+
+void SPIClass::setSlaveReply(const void * reply, uint16 length) {
+    SPISettings * port = _currentSetting;
+
+    noInterrupts();
+    port->slaveReply = length ? reply : NULL;
+    port->slaveReplyLength = length;
+    if (port->state == SPI_STATE_RECEIVE) {
+        // the old reply's first frame is already waiting in the TX buffer
+        const stm32_pin_info * nss = &PIN_MAP[nssPin()];
+        if (gpio_read_bit(nss->gpio_device, nss->gpio_bit)) {
+            slaveRestart(port);
+        }
+    }
+    interrupts();
+}
+
+// Picks the next free pool buffer for the RX DMA, or none.
+void SPIClass::slaveArm(SPISettings * port) {
+    uint32 freeMask = port->slaveFree;
+    if (freeMask == 0) {
+        port->slaveCurrent = -1;
+        return;
+    }
+    uint8 i = __builtin_ctz(freeMask);
+    port->slaveFree = freeMask & ~(1UL << i);
+    port->slaveCurrent = i;
+}
+
+// Resets the SPI, which is the only way to empty its TX buffer, and starts
+// the DMA afresh on the armed buffer and the reply.
+void SPIClass::slaveRestart(SPISettings * port) {
+    spi_rx_dma_disable(port->spi_d);
+    spi_tx_dma_disable(port->spi_d);
+    dma_disable(port->spiDmaDev, port->spiRxDmaChannel);
+    dma_disable(port->spiDmaDev, port->spiTxDmaChannel);
+
+    spi_init(port->spi_d);
+    uint32 flags = ((port->bitOrder == MSBFIRST ? SPI_FRAME_MSB : SPI_FRAME_LSB) | port->dataSize);
+    spi_slave_enable(port->spi_d, (spi_mode)port->dataMode, flags);
+    if (port->slaveCurrent < 0) return;
+
+    dma_xfer_size dma_bit_size = (port->dataSize==DATA_SIZE_16BIT) ? DMA_SIZE_16BITS : DMA_SIZE_8BITS;
+    uint32 frame = (port->dataSize==DATA_SIZE_16BIT) ? 2 : 1;
+    uint8 * buffer = port->slavePool + port->slaveCurrent * port->slaveSize * frame;
+    dma_setup_transfer(port->spiDmaDev, port->spiRxDmaChannel, &port->spi_d->regs->DR, dma_bit_size,
+                       buffer, dma_bit_size, DMA_MINC_MODE);
+    dma_set_priority(port->spiDmaDev, port->spiRxDmaChannel, DMA_PRIORITY_VERY_HIGH);
+    dma_set_num_transfers(port->spiDmaDev, port->spiRxDmaChannel, port->slaveSize);
+    dma_enable(port->spiDmaDev, port->spiRxDmaChannel);
+    spi_rx_dma_enable(port->spi_d);
+
+    if (port->slaveReply) {
+        dma_setup_transfer(port->spiDmaDev, port->spiTxDmaChannel, &port->spi_d->regs->DR, dma_bit_size,
+                           (volatile void*)port->slaveReply, dma_bit_size, (DMA_MINC_MODE | DMA_FROM_MEM));
+        dma_set_priority(port->spiDmaDev, port->spiTxDmaChannel, DMA_PRIORITY_HIGH);
+        dma_set_num_transfers(port->spiDmaDev, port->spiTxDmaChannel, port->slaveReplyLength);
+        dma_enable(port->spiDmaDev, port->spiTxDmaChannel);
+        spi_tx_dma_enable(port->spi_d); // loads the first frame straight away
+    }
+}
+
+void SPIClass::slaveNssEvent(void * arg) {
+    SPISettings * port = (SPISettings *)arg;
+    int8 i = port->slaveCurrent;
+    uint16 count = 0;
+
+    if (i >= 0) {
+        // let the DMA pick up the last frame if NSS rose right after it
+        uint32 timeout = 100;
+        while (spi_is_rx_nonempty(port->spi_d) && --timeout);
+        count = port->slaveSize - dma_get_count(port->spiDmaDev, port->spiRxDmaChannel);
+        if (count == 0) {
+            // nothing came in (e.g. a glitch on NSS): keep the same buffer
+            port->slaveFree |= (1UL << i);
+        }
+    } else {
+        port->slaveDropped++;
+    }
+
+    slaveArm(port);
+    slaveRestart(port);
+
+    if (count) {
+        uint32 frame = (port->dataSize==DATA_SIZE_16BIT) ? 2 : 1;
+        uint8 * buffer = port->slavePool + i * port->slaveSize * frame;
+        if (port->slaveCallback) {
+            port->slaveCallback(buffer, count);
+        } else {
+            port->slaveFree |= (1UL << i);
+        }
+    }
+}
+
 void SPIClass::attachInterrupt(void) {
     // Should be enableInterrupt()
 }
@@ -732,16 +1247,40 @@ uint8 SPIClass::recv(void) {
 void SPIClass::_spi1EventCallback() {
     reinterpret_cast<class SPIClass*>(_spi1_this)->EventCallback();
 }
+void SPIClass::_spi1JobCallback() {
+    SPIClass * spi = reinterpret_cast<class SPIClass*>(_spi1_this);
+    spi->JobCallback(&spi->_settings[0]);
+}
+void SPIClass::_spi1StreamCallback() {
+    SPIClass * spi = reinterpret_cast<class SPIClass*>(_spi1_this);
+    spi->StreamCallback(&spi->_settings[0]);
+}
 #endif
 #if BOARD_NR_SPI >= 2
 void SPIClass::_spi2EventCallback() {
     reinterpret_cast<class SPIClass*>(_spi2_this)->EventCallback();
 }
+void SPIClass::_spi2JobCallback() {
+    SPIClass * spi = reinterpret_cast<class SPIClass*>(_spi2_this);
+    spi->JobCallback(&spi->_settings[1]);
+}
+void SPIClass::_spi2StreamCallback() {
+    SPIClass * spi = reinterpret_cast<class SPIClass*>(_spi2_this);
+    spi->StreamCallback(&spi->_settings[1]);
+}
 #endif
 #if BOARD_NR_SPI >= 3
 void SPIClass::_spi3EventCallback() {
     reinterpret_cast<class SPIClass*>(_spi3_this)->EventCallback();
 }
+void SPIClass::_spi3JobCallback() {
+    SPIClass * spi = reinterpret_cast<class SPIClass*>(_spi3_this);
+    spi->JobCallback(&spi->_settings[2]);
+}
+void SPIClass::_spi3StreamCallback() {
+    SPIClass * spi = reinterpret_cast<class SPIClass*>(_spi3_this);
+    spi->StreamCallback(&spi->_settings[2]);
+}
 #endif
 
 /*
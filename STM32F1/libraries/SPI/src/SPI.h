@@ -99,13 +99,39 @@
 #define DATA_SIZE_8BIT SPI_CR1_DFF_8_BIT
 #define DATA_SIZE_16BIT SPI_CR1_DFF_16_BIT
 
+// Buffer transfers (write(buf, len), transfer(tx, rx, len), read(buf, len))
+// of at least this many frames go through DMA; 0 keeps them all polled.
+// Can be changed per port with SPIClass::setDMAThreshold().
+#ifndef SPI_DMA_THRESHOLD
+#define SPI_DMA_THRESHOLD 32
+#endif
+
 typedef enum {
 		SPI_STATE_IDLE,
 		SPI_STATE_READY,
 		SPI_STATE_RECEIVE,
 		SPI_STATE_TRANSMIT,
-        SPI_STATE_TRANSFER
+        SPI_STATE_TRANSFER,
+		SPI_STATE_STREAM
 	} spi_mode_t;
+
+struct SPIJob;
+
+/*
+ * Called from the DMA interrupt each time half of a stream's buffers has
+ * been transferred: rx points at the count frames just received, and tx
+ * (NULL when the stream has no TX buffer) at the count frames that can now
+ * be refilled.
+ */
+typedef void (*SPIStreamCallback)(void *rx, void *tx, uint16 count);
+
+/*
+ * Called from the NSS interrupt with each frame received by
+ * beginSlaveReceive(). The buffer belongs to the application until it is
+ * given back with SPIClass::releaseSlaveBuffer().
+ */
+typedef void (*SPISlaveCallback)(void *buffer, uint16 count);
+
 class SPISettings {
 public:
 	SPISettings(uint32_t clock, BitOrder bitOrder, uint8_t dataMode) {
@@ -152,10 +178,64 @@ private:
 	dma_dev* spiDmaDev;
   void (*receiveCallback)(void) = NULL;
   void (*transmitCallback)(void) = NULL;
+  SPIJob * volatile jobHead = NULL; // job in progress, followed by the queued ones
+  SPIJob *jobTail = NULL;
+  uint32 dmaThreshold = SPI_DMA_THRESHOLD;
+  bool dmaYield = false;
+  SPIStreamCallback streamCallback = NULL;
+  void *streamRx;
+  void *streamTx;
+  uint16 streamLength;
+  SPISlaveCallback slaveCallback = NULL;
+  uint8 *slavePool;
+  uint16 slaveSize;              // frames per pool buffer
+  volatile uint32 slaveFree;     // one bit per pool buffer not handed out
+  volatile int8 slaveCurrent;    // pool buffer armed for the next frame, -1 if none
+  const void *slaveReply = NULL;
+  uint16 slaveReplyLength = 0;
+  volatile uint32 slaveDropped;
+  void (*lockHook)(void *) = NULL;
+  void (*unlockHook)(void *) = NULL;
+  void *lockArg;
 	
 	friend class SPIClass;
 };
 
+// csPin value for devices and jobs whose chip select isn't driven by SPIClass
+#define SPI_NO_CS 0xFF
+
+/*
+ * A device on a shared bus, set up once with SPIClass::addDevice() and then
+ * used with beginTransaction(device) / endTransaction(device). It keeps the
+ * complete CR1 value for the device, so that switching to it is a single
+ * register write, skipped when the bus is already set up that way.
+ */
+class SPIDevice {
+public:
+	SPIDevice() : cr1(0), csPin(SPI_NO_CS), port(0) {}
+private:
+	uint16 cr1;
+	uint8 csPin;
+	uint8 port;                     // index into SPIClass::_settings
+
+	friend class SPIClass;
+};
+
+/*
+ * A DMA transfer queued with SPIClass::queueTransfer(). It must stay
+ * untouched until its callback has been called.
+ */
+struct SPIJob {
+	SPISettings settings;
+	uint8 csPin;                    // held low during the transfer, or SPI_NO_CS
+	const void *txBuf;              // NULL sends 0xFF (0xFFFF in 16 bit mode)
+	void *rxBuf;                    // NULL throws away what's received
+	uint16 length;                  // in frames, as for dmaTransfer()
+	void (*callback)(SPIJob *job);  // called from the DMA interrupt, may be NULL
+	void *extra;                    // for the callback's own use
+	SPIJob *next;                   // used by the queue
+};
+
 
 /*
  * Kept for compat.
@@ -210,6 +290,49 @@ public:
 
 	void beginTransactionSlave(SPISettings settings);
 
+	/**
+	 * @brief Sets up a device on this bus for beginTransaction(device).
+	 *
+	 * Works out the device's CR1 value and makes csPin an output, high.
+	 * The device stays on the current port, even after setModule().
+	 * The bus itself has to be started once with begin().
+	 *
+	 * @param csPin Chip select, or SPI_NO_CS to drive it yourself.
+	 */
+	void addDevice(SPIDevice &device, uint8 csPin, const SPISettings &settings);
+
+	/**
+	 * @brief Takes the bus lock (if any), switches the bus to device and
+	 * lowers its chip select.
+	 *
+	 * The device's port becomes the current one, as with setModule().
+	 */
+	void beginTransaction(SPIDevice &device);
+
+	/**
+	 * @brief Raises device's chip select and releases the bus lock.
+	 */
+	void endTransaction(SPIDevice &device);
+
+	/**
+	 * @brief Sets functions that beginTransaction(),
+	 * beginTransactionSlave() and endTransaction() call to claim and
+	 * release the bus, e.g. for tasks sharing it under FreeRTOS:
+	 *
+	 *   SemaphoreHandle_t spiMutex = xSemaphoreCreateRecursiveMutex();
+	 *   void spiLock(void *m) { xSemaphoreTakeRecursive((SemaphoreHandle_t)m, portMAX_DELAY); }
+	 *   void spiUnlock(void *m) { xSemaphoreGiveRecursive((SemaphoreHandle_t)m); }
+	 *   SPI.setLockHooks(spiLock, spiUnlock, spiMutex);
+	 *
+	 * @param lock Called with arg before a transaction, NULL for none.
+	 * @param unlock Called with arg after a transaction, NULL for none.
+	 */
+	void setLockHooks(void (*lock)(void *), void (*unlock)(void *), void *arg = NULL) {
+		_currentSetting->lockHook = lock;
+		_currentSetting->unlockHook = unlock;
+		_currentSetting->lockArg = arg;
+	}
+
 	void setClockDivider(uint32_t clockDivider);
 	void setBitOrder(BitOrder bitOrder);	
 	void setDataMode(uint8_t dataMode);		
@@ -233,6 +356,25 @@ public:
     void onReceive(void(*)(void));
     void onTransmit(void(*)(void));
 
+    /**
+     * @brief Sets the size from which buffer transfers use DMA.
+     *
+     * write(buf, len), transfer(tx, rx, len) and read(buf, len) of at least
+     * threshold frames are handed to the DMA channels, unless a DMA
+     * callback, job queue or stream is using them, or another peripheral
+     * sharing them has one enabled or a handler attached. Only master
+     * ports use DMA. The call still returns only once the transfer is done,
+     * or the DMA has timed out (then the rest of the buffer isn't sent).
+     *
+     * @param threshold Frames; 0 to always poll.
+     * @param yielding Call yield() while waiting for the DMA, e.g. to let
+     *                 other tasks run.
+     */
+    void setDMAThreshold(uint32 threshold, bool yielding = false) {
+        _currentSetting->dmaThreshold = threshold;
+        _currentSetting->dmaYield = yielding;
+    }
+
     /*
      * I/O
      */
@@ -324,6 +466,108 @@ public:
     uint8 dmaSendRepeat(uint16 length);
 
     uint8 dmaSendAsync(const void * transmitBuf, uint16 length, bool minc = 1);
+
+	/**
+     * @brief Queues a DMA transfer behind the ones already queued.
+	 *
+	 * Each job brings its own settings and chip select pin. When a job
+	 * finishes, the DMA interrupt raises its chip select, reconfigures the
+	 * port for the next job (only if its settings differ), lowers that
+	 * job's chip select and starts it, then calls the finished job's
+	 * callback. Several devices can so share the bus back to back without
+	 * the main loop being involved.
+	 *
+	 * The port must have been started with begin(), and chip select pins
+	 * set up as outputs, high. While jobs are queued, don't use the other
+	 * transfer functions on this port. The queue takes over the RX DMA
+	 * interrupt, and gives it back to onReceive() when it empties.
+	 *
+	 * @param job Transfer to queue. May be queued again from its callback.
+	 * @return false if the port isn't started, is streaming, or the job is
+	 * empty, or if its DMA channels are taken by another peripheral.
+	 */
+    bool queueTransfer(SPIJob * job);
+
+	/**
+     * @brief Returns true while queued transfers are in progress.
+	 */
+    bool queueBusy(void) { return _currentSetting->jobHead != NULL; }
+
+	/**
+     * @brief Starts a continuous transfer with both DMA channels in
+	 * circular mode.
+	 *
+	 * The port transfers without a break, over and over, until endStream(),
+	 * and callback is called as each half of the buffers comes round, so
+	 * one half can be processed (or refilled) while the other is in use.
+	 * As a master the clock runs continuously; as a slave it follows the
+	 * master's clock.
+	 *
+	 * @param rxBuf Buffer received into.
+	 * @param txBuf Buffer sent from, or NULL to send 0xFF (0xFFFF).
+	 * @param length Frames in each buffer; must be even.
+	 * @param callback Half/full buffer callback, from the DMA interrupt.
+	 * @return false if the port is busy or not started, length is odd, or
+	 * its DMA channels are taken by another peripheral.
+	 */
+    bool beginStream(void * rxBuf, void * txBuf, uint16 length, SPIStreamCallback callback);
+
+	/**
+     * @brief Stops a stream started with beginStream().
+	 *
+	 * A master finishes the frame in progress; a slave drops it, since
+	 * its master needn't stop clocking.
+	 */
+    void endStream(void);
+
+	/**
+     * @brief Receives whole frames as a slave, by DMA.
+	 *
+	 * A frame is everything clocked in while NSS is low. The RX DMA is
+	 * armed with a free pool buffer; when NSS goes high, the frame is handed
+	 * to callback, the SPI is reset so the next frame starts cleanly, and
+	 * the next free buffer is armed. If no buffer is free, frames are
+	 * dropped (and counted) until one is released. The master should leave
+	 * NSS high for a few microseconds between frames.
+	 *
+	 * The port must have been started with beginSlave() or
+	 * beginTransactionSlave().
+	 *
+	 * @param pool count buffers of bufferSize frames each, back to back.
+	 * @param bufferSize Frames per buffer; longer frames are cut short.
+	 * @param count Number of buffers in the pool, at most 32.
+	 * @param callback Frame callback, from the NSS interrupt.
+	 * @return false if the port is busy or not started, the pool is empty,
+	 * or its DMA channels are taken by another peripheral.
+	 */
+    bool beginSlaveReceive(void * pool, uint16 bufferSize, uint8 count, SPISlaveCallback callback);
+
+	/**
+     * @brief Stops the frame receiver started with beginSlaveReceive().
+	 */
+    void endSlaveReceive(void);
+
+	/**
+     * @brief Gives a buffer handed to the frame callback back to the pool.
+	 */
+    void releaseSlaveBuffer(void * buffer);
+
+	/**
+     * @brief Sets what the slave sends back in each frame.
+	 *
+	 * The reply is loaded into the TX DMA when the receiver is armed, so the
+	 * master gets it from its first clock. Called between frames, it applies
+	 * to the next one. The buffer must stay valid while it is in use.
+	 *
+	 * @param reply Frames to send, or NULL to send nothing in particular.
+	 * @param length Number of frames in reply.
+	 */
+    void setSlaveReply(const void * reply, uint16 length);
+
+	/**
+     * @brief Number of frames lost because no pool buffer was free.
+	 */
+    uint32 slaveFramesDropped(void) { return _currentSetting->slaveDropped; }
     /*
      * Pin accessors
      */
@@ -408,21 +652,40 @@ private:
 	SPISettings *_currentSetting;
 
 	void updateSettings(void);
+	static uint32 masterCR1(const SPISettings &settings, uint32 clockDivider);
+	static void applyCR1(SPISettings * port, uint32 cr1);
+	bool useDma(uint32 length);
+	uint32 dmaChunk(void);
+	static bool dmaChannelsFree(SPISettings * port);
     /*
 	* Functions added for DMA transfers with Callback. 
 	* Experimental.
 	*/
 
     void EventCallback(void);
+    void startJob(SPISettings * port);
+    void JobCallback(SPISettings * port);
+    void StreamCallback(SPISettings * port);
+    static void slaveRestart(SPISettings * port);
+    static void slaveArm(SPISettings * port);
+    static void slaveNssEvent(void * port);
+    enum { RX_IRQ_EVENT, RX_IRQ_JOB, RX_IRQ_STREAM };
+    void attachRxInterrupt(SPISettings * port, uint8 handler);
 
     #if BOARD_NR_SPI >= 1
     static void _spi1EventCallback(void);
+    static void _spi1JobCallback(void);
+    static void _spi1StreamCallback(void);
     #endif
     #if BOARD_NR_SPI >= 2
     static void _spi2EventCallback(void);
+    static void _spi2JobCallback(void);
+    static void _spi2StreamCallback(void);
     #endif
     #if BOARD_NR_SPI >= 3
     static void _spi3EventCallback(void);
+    static void _spi3JobCallback(void);
+    static void _spi3StreamCallback(void);
     #endif
 	/*
 	spi_dev *spi_d;
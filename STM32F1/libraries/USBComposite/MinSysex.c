@@ -35,8 +35,8 @@
 #define USB_MIDI
 #ifdef USB_MIDI
 
-// change this to packets
-#define STANDARD_ID_RESPONSE_LENGTH 7
+// in event packets
+#define STANDARD_ID_RESPONSE_LENGTH (sizeof(standardIDResponse)/4)
 
 #include "usb_midi_device.h"
 #include <libmaple/delay.h>
@@ -142,6 +142,7 @@ void dealWithItQuickly(){
             switch (sysexBuffer[3]) {
                 case USYSEX_GENERAL_INFO:
                     if (sysexBuffer[4]==USYSEX_GI_ID_REQUEST) {
+                        // queued, so it isn't lost if we're in the middle of sending
                         usb_midi_tx((uint32 *) standardIDResponse, STANDARD_ID_RESPONSE_LENGTH);
                     }
             }
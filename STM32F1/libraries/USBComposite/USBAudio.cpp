@@ -51,6 +51,11 @@ uint16 USBAUDIO::getSamplePeriod(void)
     return samplePeriod;
 }
 
+uint32 USBAUDIO::getBufferLevel(void)
+{
+    return usb_audio_get_buffer_level();
+}
+
 static void setSamplePeriod(uint16 *samplePeriod, uint16 sampleRate)
 {
     *samplePeriod = 1000000 / sampleRate - 1;
@@ -32,4 +32,6 @@ public:
     uint32 write(const uint8* buffer, uint32 length);
     uint32 read(uint8* buffer, uint32 length);
     uint16 getSamplePeriod(void);
+    uint32 getBufferLevel(void);
+    uint32 getBufferSize(void) { return USB_AUDIO_BUFFER_SIZE; }
 };
@@ -0,0 +1,29 @@
+#include "USBComposite.h"
+#include "usb_bulk_stream.h"
+
+bool USBBulkStream::init(USBBulkStream* me) {
+    usb_bulk_stream_setTXEPSize(me->txPacketSize);
+    usb_bulk_stream_setRXEPSize(me->rxPacketSize);
+    return true;
+}
+
+bool USBBulkStream::registerComponent() {
+    return USBComposite.add(&usbBulkStreamPart, this, (USBPartInitializer)&USBBulkStream::init);
+}
+
+void USBBulkStream::begin() {
+    if (!enabled) {
+        USBComposite.clear();
+        registerComponent();
+        USBComposite.begin();
+
+        enabled = true;
+    }
+}
+
+void USBBulkStream::end() {
+    if (enabled) {
+        USBComposite.end();
+        enabled = false;
+    }
+}
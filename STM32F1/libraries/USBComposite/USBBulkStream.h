@@ -0,0 +1,48 @@
+#ifndef USBBULKSTREAM_H
+#define USBBULKSTREAM_H
+
+#include <boards.h>
+#include "USBComposite.h"
+#include "usb_generic.h"
+#include "usb_bulk_stream.h"
+
+// Vendor-specific bulk IN/OUT interface that streams whole buffers. Submitted
+// buffers must stay untouched until their callback, which is made from the
+// USB interrupt. Up to USB_BULK_STREAM_QUEUE_LENGTH buffers can be queued in
+// each direction. Rx buffers should be a multiple of the packet size, as a
+// packet that doesn't fit is cut short.
+class USBBulkStream {
+private:
+    bool enabled = false;
+    uint32 txPacketSize = 64;
+    uint32 rxPacketSize = 64;
+public:
+    static bool init(USBBulkStream* me);
+    bool registerComponent();
+    void begin();
+    void end();
+    void setTXPacketSize(uint32 size=64) {
+        txPacketSize = size;
+    }
+    void setRXPacketSize(uint32 size=64) {
+        rxPacketSize = size;
+    }
+    void setCallbacks(USBBulkStreamCallback txDone, USBBulkStreamCallback rxDone = NULL, void* extra = NULL) {
+        usb_bulk_stream_set_callbacks(txDone, rxDone, extra);
+    }
+    // false if the queue is full
+    bool submitTX(const uint8* buffer, uint32 length) {
+        return usb_bulk_stream_submit_tx(buffer, length);
+    }
+    bool submitRX(uint8* buffer, uint32 length) {
+        return usb_bulk_stream_submit_rx(buffer, length);
+    }
+    uint32 queuedTX() {
+        return usb_bulk_stream_tx_queued();
+    }
+    uint32 queuedRX() {
+        return usb_bulk_stream_rx_queued();
+    }
+};
+
+#endif
@@ -80,11 +80,41 @@ bool USBCompositeDevice::begin() {
 	usb_generic_set_info(vendorId, productId, iManufacturer, iProduct, iSerialNumber);
     if (! usb_generic_set_parts(parts, numParts))
         return false;
+    if (layoutReport != NULL)
+        reportLayout();
     usb_generic_enable();
     enabled = true;  
     return true;
 }
 
+void USBCompositeDevice::reportLayout() {
+    static const char* const typeNames[] = { "bulk", "ctrl", "iso", "int" };
+    Print* out = layoutReport;
+
+    for (uint32 i = 0 ; i < numParts ; i++) {
+        out->print("part ");
+        out->println(i);
+        for (uint32 j = 0 ; j < parts[i]->numEndpoints ; j++) {
+            USBEndpointInfo* ep = &(parts[i]->endpoints[j]);
+            out->print("  ep");
+            out->print(ep->address);
+            out->print(ep->tx ? " in  " : " out ");
+            out->print(typeNames[ep->type & 3]);
+            out->print(" pma 0x");
+            out->print(usb_generic_pma_offset(ep), HEX);
+            out->print(" size ");
+            out->print(ep->pmaSize);
+            if (ep->doubleBuffer)
+                out->print(ep->canDoubleBuffer ? " x2" : " double");
+            out->println();
+        }
+    }
+    out->print("pma used ");
+    out->print(usb_generic_pma_used());
+    out->print(" of ");
+    out->println(PMA_MEMORY_SIZE);
+}
+
 void USBCompositeDevice::end() {
     if (!enabled)
         return;
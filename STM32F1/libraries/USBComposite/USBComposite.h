@@ -32,6 +32,8 @@ private:
     void* plugin[USB_COMPOSITE_MAX_PARTS];
     uint32 numParts;
     bool enabled = false;
+    Print* layoutReport = NULL;
+    void reportLayout(void);
 public:
     USBCompositeDevice(void); 
     void setVendorId(uint16 vendor=0);
@@ -39,6 +41,11 @@ public:
     void setManufacturerString(const char* manufacturer=NULL);
     void setProductString(const char* product=NULL);
     void setSerialString(const char* serialNumber=DEFAULT_SERIAL_STRING);
+    // If set, begin() prints the endpoint and packet memory layout here.
+    // This has to be something other than a USB part, e.g. Serial1.
+    void setLayoutReport(Print* out=NULL) {
+        layoutReport = out;
+    }
     bool begin(void);
     void end(void);
     void clear();
@@ -63,5 +70,6 @@ extern USBCompositeDevice USBComposite;
 #include <USBAudio.h>
 #include <USBMultiSerial.h>
 #include <USBXBox360.h>
+#include <USBBulkStream.h>
 #endif
         
\ No newline at end of file
@@ -199,6 +199,12 @@ void HIDReporter::sendReport() {
     unsigned toSend = bufferSize;
     uint8* b = reportBuffer;
     
+    /* queue the report whole, so that it goes out in packets of its own */
+    if (bufferSize <= HID_TX_BUFFER_SIZE / 2) {
+        while (usb_hid_tx_latest(b, toSend, txMode, &txSlot) == 0) ;
+        return;
+    }
+
     while (toSend) {
         unsigned delta = usb_hid_tx(b, toSend);
         toSend -= delta;
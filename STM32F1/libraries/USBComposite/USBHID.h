@@ -467,6 +467,8 @@ class HIDReporter {
         HIDReportDescriptor reportDescriptor;
         struct usb_chunk reportChunks[3];
         class HIDReporter* next;
+        uint8_t txMode = 0;
+        HIDTxSlot_t txSlot = { 0, 0 };
         friend class USBHID;
 
     protected:
@@ -474,6 +476,15 @@ class HIDReporter {
         
     public:
         void sendReport(); 
+        // Optional coalescing for reporters that describe a state rather than
+        // events: HID_TX_SKIP_UNCHANGED drops a report identical to the last
+        // one, and HID_TX_LATEST_ONLY replaces a report the host hasn't polled
+        // yet, so sendReport() doesn't wait on a busy endpoint. Don't use them
+        // where each report counts, e.g. relative mouse movement. 0 turns
+        // them off (the default).
+        void setCoalescing(uint8_t mode = HID_TX_SKIP_UNCHANGED | HID_TX_LATEST_ONLY) {
+            txMode = mode;
+        }
         uint8_t* getReport() {
             return reportBuffer;
         }
@@ -106,6 +106,8 @@ void USBMIDI::writePackets(const void *buf, uint32 len) {
 
     uint32 sent = 0;
 
+    // Packets are queued, and go out up to 16 to a USB packet; this only
+    // waits while the queue is full.
     while (txed < len && (millis() - start < USB_TIMEOUT)) {
         sent = usb_midi_tx((const uint32*)buf + txed, len - txed);
         txed += sent;
@@ -114,14 +116,14 @@ void USBMIDI::writePackets(const void *buf, uint32 len) {
         }
         old_txed = txed;
     }
+}
 
+void USBMIDI::flush(void) {
+    usb_midi_flush_tx();
+}
 
-    if (sent == usb_midi_txEPSize) {
-        while (usb_midi_is_transmitting() != 0) {
-        }
-        /* flush out to avoid having the pc wait for more data */
-        usb_midi_tx(NULL, 0);
-    }
+void USBMIDI::setTXLatency(uint32 ms) {
+    usb_midi_set_tx_latency(ms);
 }
 
 uint32 USBMIDI::available(void) {
@@ -276,6 +278,7 @@ void USBMIDI::poll(void)
 {   while(available()) {
         dispatchPacket(readPacket());
     }
+    usb_midi_service_tx();
 }
 
 static union EVENT_t outPacket; // since we only use one at a time no point in reallocating it
@@ -458,7 +461,7 @@ void USBMIDI::sendReset(void)
 void USBMIDI::sendSysex(uint8_t b0, uint8_t b1, uint8_t b2)
 {
     outPacket.p.cable = DEFAULT_MIDI_CABLE;
-    outPacket.p.cin = CIN_SYSEX_ENDS_IN_3;
+    outPacket.p.cin = CIN_SYSEX;
     outPacket.p.midi0 = b0;
     outPacket.p.midi1 = b1;
     outPacket.p.midi2 = b2;
@@ -495,39 +498,46 @@ void USBMIDI::sendSysexEndsIn3(uint8_t b0, uint8_t b1, uint8_t b2)
     writePacket(outPacket.i);
 }
 
+// The payload goes between F0 and F7; event packets are built straight
+// from it, a full USB packet (16 events) at a time.
 void USBMIDI::sendSysexPayload(uint8_t *payload, uint32 length)
 {
-    outPacket.p.cable=DEFAULT_MIDI_CABLE;
-    if (length == 1)
-    {
-        sendSysexEndsIn3(MIDIv1_SYSEX_START, payload[0], MIDIv1_SYSEX_END);
-        return;
-    }
-
-    sendSysex(MIDIv1_SYSEX_START, payload[0], payload[1]);
-
-    unsigned int offset = 2;
-    for (; offset < length - 2; offset += 3)
-    {
-        sendSysex(payload[offset], payload[offset + 1], payload[offset + 2]);
-    }
+    union EVENT_t chunk[16];
+    uint32 n = 0;
+    uint32 total = length + 2;
+
+    for (uint32 pos = 0; pos < total; pos += 3) {
+        uint32 left = total - pos;
+        union EVENT_t *e = &chunk[n++];
+
+        e->i = 0;
+        e->p.cable = DEFAULT_MIDI_CABLE;
+        if (left > 3)
+            e->p.cin = CIN_SYSEX;
+        else if (left == 3)
+            e->p.cin = CIN_SYSEX_ENDS_IN_3;
+        else if (left == 2)
+            e->p.cin = CIN_SYSEX_ENDS_IN_2;
+        else
+            e->p.cin = CIN_SYSEX_ENDS_IN_1;
+
+        for (uint32 k = 0; k < 3 && k < left; k++) {
+            uint32 at = pos + k;
+            if (at == 0)
+                e->b[1 + k] = MIDIv1_SYSEX_START;
+            else if (at == total - 1)
+                e->b[1 + k] = MIDIv1_SYSEX_END;
+            else
+                e->b[1 + k] = payload[at - 1];
+        }
 
-    unsigned int remaining = length - offset;
-    if (remaining == 0)
-    {
-        sendSysexEndsIn1(MIDIv1_SYSEX_END);
-    }
-    else if (remaining == 1)
-    {
-        sendSysexEndsIn2(payload[offset], MIDIv1_SYSEX_END);
-    }
-    else
-    {
-        sendSysexEndsIn3(payload[offset], payload[offset + 1], MIDIv1_SYSEX_END);
+        if (n == sizeof(chunk) / sizeof(*chunk) || left <= 3) {
+            writePackets(chunk, n);
+            n = 0;
+        }
     }
 }
 
-
 const uint32 midiNoteFrequency_10ths[128] = {
 	 82, 87, 92, 97, 103, 109, 116, 122, 130, 138, 146, 154, 164, 173, 184, 194, 
 	 206, 218, 231, 245, 260, 275, 291, 309, 327, 346, 367, 389, 412, 437, 462, 490, 
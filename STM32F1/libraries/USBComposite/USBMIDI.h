@@ -148,6 +148,13 @@ public:
     uint8 isConnected();
     uint8 pending();
 
+    // Outgoing packets are queued and sent up to 16 per USB packet. By
+    // default a packet goes out as soon as the port is idle; with a
+    // latency, a part-filled one waits up to that many ms for more events
+    // (call poll() or flush() regularly then). flush() sends what's queued.
+    void setTXLatency(uint32 ms = 0);
+    void flush();
+
     // poll() should be called every time through loop() IF dealing with incoming MIDI
     //  (if you're only SENDING MIDI events from the Arduino, you don't need to call
     //  poll); it causes data to be read from the USB port and processed.
@@ -38,6 +38,15 @@ void USBMassStorage::setDriveData(uint32 driveNumber, uint32 numSectors, MassSto
 	usb_mass_drives[driveNumber].format = initializer;
 }
 
+void USBMassStorage::setDriveSplitPhase(uint32 driveNumber, MassStorageReader readStarter,
+	MassStorageWriter writeStarter, MassStorageFinisher finisher) {
+	if (driveNumber >= USB_MASS_MAX_DRIVES)
+		return;
+	usb_mass_drives[driveNumber].readStart = readStarter;
+	usb_mass_drives[driveNumber].writeStart = writeStarter;
+	usb_mass_drives[driveNumber].finish = finisher;
+}
+
 void USBMassStorage::clearDrives() {
 	memset(usb_mass_drives, 0, sizeof(usb_mass_drives));
 }
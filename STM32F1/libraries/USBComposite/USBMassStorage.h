@@ -17,6 +17,8 @@ public:
   bool registerComponent();
   void setDriveData(uint32 driveNumber, uint32 numSectors, MassStorageReader reader,
 	MassStorageWriter writer = NULL, MassStorageStatuser = NULL, MassStorageInitializer = NULL);
+  void setDriveSplitPhase(uint32 driveNumber, MassStorageReader readStarter,
+	MassStorageWriter writeStarter, MassStorageFinisher finisher);
 };
 
 #endif	/* USBMASSSTORAGE_H */
@@ -0,0 +1,56 @@
+// Streams a counter to the host over a vendor-specific bulk interface as
+// fast as it will take it, and throws away whatever the host sends.
+// Run bulkspeed (see host/bulkspeed.c) on the host to measure the throughput.
+//
+// The two halves of txBuffer stand in for the halves of a circular DMA
+// buffer: each one is refilled once its callback says USB is done with it.
+
+#include <USBComposite.h>
+
+#define PRODUCT_ID 0x30
+#define HALF 1024
+
+USBBulkStream BulkStream;
+
+uint32 txBuffer[2][HALF/4];
+uint8 rxBuffer[2][HALF];
+volatile bool txFree[2] = { false, false };
+volatile uint32 received = 0;
+uint32 counter = 0;
+
+void fill(uint32* buffer) {
+  for (uint32 i = 0; i < HALF/4; i++)
+    buffer[i] = counter++;
+}
+
+// both called from the USB interrupt
+void txDone(void* extra, uint8* buffer, uint32 length) {
+  txFree[buffer == (uint8*)txBuffer[1]] = true;
+}
+
+void rxDone(void* extra, uint8* buffer, uint32 length) {
+  received += length;
+  BulkStream.submitRX(buffer, HALF);
+}
+
+void setup() {
+  USBComposite.setProductId(PRODUCT_ID);
+  BulkStream.setCallbacks(txDone, rxDone);
+  fill(txBuffer[0]);
+  fill(txBuffer[1]);
+  BulkStream.submitTX((uint8*)txBuffer[0], HALF);
+  BulkStream.submitTX((uint8*)txBuffer[1], HALF);
+  BulkStream.submitRX(rxBuffer[0], HALF);
+  BulkStream.submitRX(rxBuffer[1], HALF);
+  BulkStream.begin();
+}
+
+void loop() {
+  for (int i = 0; i < 2; i++) {
+    if (txFree[i]) {
+      txFree[i] = false;
+      fill(txBuffer[i]);
+      BulkStream.submitTX((uint8*)txBuffer[i], HALF);
+    }
+  }
+}
@@ -0,0 +1,155 @@
+/*
+ * Host side of the bulkstream example: measures how fast the board streams
+ * data in over its vendor-specific bulk interface, checking that the
+ * counter it sends has no gaps, and then how fast it takes data out.
+ *
+ * Build with libusb-1.0:
+ *   cc -O2 -o bulkspeed bulkspeed.c $(pkg-config --cflags --libs libusb-1.0)
+ *
+ * Usage: bulkspeed [seconds [vid pid]]
+ *
+ * On Linux you may need a udev rule (or root) to open the device. On Windows
+ * the interface must first be bound to WinUSB, e.g. with Zadig.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <libusb.h>
+
+#define DEFAULT_VID 0x1EAF
+#define DEFAULT_PID 0x0030
+#define CHUNK 16384
+#define TIMEOUT_MS 1000
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* find the first vendor-specific interface with a bulk endpoint each way */
+static int find_interface(libusb_device_handle* dev, int* iface, unsigned char* in, unsigned char* out) {
+    struct libusb_config_descriptor* config;
+    int i, j, found = 0;
+
+    if (libusb_get_active_config_descriptor(libusb_get_device(dev), &config) != 0)
+        return 0;
+
+    for (i = 0; i < config->bNumInterfaces && !found; i++) {
+        const struct libusb_interface_descriptor* d = &config->interface[i].altsetting[0];
+        if (d->bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC)
+            continue;
+        *in = *out = 0;
+        for (j = 0; j < d->bNumEndpoints; j++) {
+            const struct libusb_endpoint_descriptor* e = &d->endpoint[j];
+            if ((e->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_BULK)
+                continue;
+            if (e->bEndpointAddress & LIBUSB_ENDPOINT_IN)
+                *in = e->bEndpointAddress;
+            else
+                *out = e->bEndpointAddress;
+        }
+        if (*in && *out) {
+            *iface = d->bInterfaceNumber;
+            found = 1;
+        }
+    }
+
+    libusb_free_config_descriptor(config);
+    return found;
+}
+
+static void test_in(libusb_device_handle* dev, unsigned char ep, double seconds) {
+    static uint32_t buf[CHUNK/4];
+    unsigned long long total = 0;
+    unsigned long errors = 0;
+    uint32_t expected = 0;
+    int synced = 0;
+    double start = now(), elapsed;
+
+    do {
+        int got, i, r;
+        r = libusb_bulk_transfer(dev, ep, (unsigned char*)buf, CHUNK, &got, TIMEOUT_MS);
+        if (r != 0 && r != LIBUSB_ERROR_TIMEOUT) {
+            fprintf(stderr, "IN transfer failed: %s\n", libusb_error_name(r));
+            break;
+        }
+        for (i = 0; i < got / 4; i++) {
+            if (synced && buf[i] != expected)
+                errors++;
+            expected = buf[i] + 1;
+            synced = 1;
+        }
+        total += got;
+    } while ((elapsed = now() - start) < seconds);
+
+    printf("IN:  %llu bytes in %.2f s = %.1f kB/s, %lu counter errors\n",
+           total, elapsed, total / elapsed / 1000, errors);
+}
+
+static void test_out(libusb_device_handle* dev, unsigned char ep, double seconds) {
+    static unsigned char buf[CHUNK];
+    unsigned long long total = 0;
+    double start = now(), elapsed;
+
+    memset(buf, 0x55, sizeof buf);
+    do {
+        int sent, r;
+        r = libusb_bulk_transfer(dev, ep, buf, CHUNK, &sent, TIMEOUT_MS);
+        if (r != 0 && r != LIBUSB_ERROR_TIMEOUT) {
+            fprintf(stderr, "OUT transfer failed: %s\n", libusb_error_name(r));
+            break;
+        }
+        total += sent;
+    } while ((elapsed = now() - start) < seconds);
+
+    printf("OUT: %llu bytes in %.2f s = %.1f kB/s\n", total, elapsed, total / elapsed / 1000);
+}
+
+int main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 5;
+    int vid = argc > 3 ? (int)strtol(argv[2], NULL, 16) : DEFAULT_VID;
+    int pid = argc > 3 ? (int)strtol(argv[3], NULL, 16) : DEFAULT_PID;
+    libusb_device_handle* dev;
+    unsigned char in, out;
+    int iface, r;
+
+    if (libusb_init(NULL) != 0) {
+        fprintf(stderr, "cannot initialize libusb\n");
+        return 1;
+    }
+
+    dev = libusb_open_device_with_vid_pid(NULL, vid, pid);
+    if (dev == NULL) {
+        fprintf(stderr, "device %04x:%04x not found\n", vid, pid);
+        libusb_exit(NULL);
+        return 1;
+    }
+
+    if (!find_interface(dev, &iface, &in, &out)) {
+        fprintf(stderr, "no vendor-specific bulk interface\n");
+        libusb_close(dev);
+        libusb_exit(NULL);
+        return 1;
+    }
+
+    libusb_set_auto_detach_kernel_driver(dev, 1);
+    r = libusb_claim_interface(dev, iface);
+    if (r != 0) {
+        fprintf(stderr, "cannot claim interface %d: %s\n", iface, libusb_error_name(r));
+        libusb_close(dev);
+        libusb_exit(NULL);
+        return 1;
+    }
+
+    test_in(dev, in, seconds);
+    test_out(dev, out, seconds);
+
+    libusb_release_interface(dev, iface);
+    libusb_close(dev);
+    libusb_exit(NULL);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Measures the cycles taken by the packet memory (PMA) copy routines
+ * that every USBComposite part uses on each packet, for aligned,
+ * unaligned and wrapping circular-buffer copies of a 64-byte packet.
+ *
+ * The copies run before the USB device is started, on the PMA area that
+ * endpoint 0 will use later, and the results are printed once the
+ * composite serial port is up.
+ */
+
+#include <USBComposite.h>
+#include <libmaple/rcc.h>
+
+// Cortex-M3 debug cycle counter
+#define DEMCR       (*(volatile uint32 *)0xE000EDFC)
+#define DWT_CTRL    (*(volatile uint32 *)0xE0001000)
+#define DWT_CYCCNT  (*(volatile uint32 *)0xE0001004)
+
+#define PACKET      64
+#define RUNS        100
+
+USBCompositeSerial CompositeSerial;
+
+static uint8 ram[PACKET + 4] __attribute__((aligned(4)));
+static uint8 circular[256];
+static uint32 results[6];
+
+static const char* names[6] = {
+  "to PMA, aligned:         ",
+  "to PMA, unaligned:       ",
+  "from PMA, aligned:       ",
+  "from PMA, unaligned:     ",
+  "to PMA, circular wrap:   ",
+  "from PMA, circular wrap: ",
+};
+
+static uint32* pma(void) {
+  return usb_pma_ptr(USB_EP0_TX_BUFFER_ADDRESS);
+}
+
+// Best of RUNS, in cycles
+#define MEASURE(result, code)                 \
+  do {                                        \
+    uint32 best = 0xFFFFFFFF;                 \
+    for (int run = 0; run < RUNS; run++) {    \
+      uint32 start = DWT_CYCCNT;              \
+      code;                                   \
+      uint32 cycles = DWT_CYCCNT - start;     \
+      if (cycles < best) best = cycles;       \
+    }                                         \
+    result = best;                            \
+  } while (0)
+
+void benchmark() {
+  volatile uint32 index;
+
+  rcc_clk_enable(RCC_USB);
+  DEMCR |= (1 << 24);           // TRCENA
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= 1;                // CYCCNTENA
+
+  MEASURE(results[0], usb_copy_to_pma_ptr(ram, PACKET, pma()));
+  MEASURE(results[1], usb_copy_to_pma_ptr(ram + 1, PACKET, pma()));
+  MEASURE(results[2], usb_copy_from_pma_ptr(ram, PACKET, pma()));
+  MEASURE(results[3], usb_copy_from_pma_ptr(ram + 1, PACKET, pma()));
+  MEASURE(results[4], index = sizeof(circular) - 31;
+                      usb_copy_to_pma_ptr_circular(circular, sizeof(circular), &index, PACKET, pma()));
+  MEASURE(results[5], index = sizeof(circular) - 31;
+                      usb_copy_from_pma_ptr_circular(circular, sizeof(circular), &index, PACKET, pma()));
+}
+
+void setup() {
+  benchmark();
+  CompositeSerial.begin();
+  while (!USBComposite);
+}
+
+void loop() {
+  CompositeSerial.println("Cycles per 64-byte packet:");
+  for (int i = 0; i < 6; i++) {
+    CompositeSerial.print(names[i]);
+    CompositeSerial.println(results[i]);
+  }
+  CompositeSerial.println();
+  delay(2000);
+}
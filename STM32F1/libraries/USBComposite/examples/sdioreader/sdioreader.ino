@@ -0,0 +1,64 @@
+// USB card reader on the SDIO peripheral (high density F103 only).
+// Uses the greiman sdfat library for card setup, and the split-phase
+// SDIO transfers so the card's DMA runs while USB packets go out.
+// For more overlap, build with a larger SCSI_BUFFER_SECTORS (e.g. 8).
+#include <USBComposite.h>
+#include <SdioF1.h>
+
+USBMassStorage MassStorage;
+
+#define LED_PIN PB12
+#define PRODUCT_ID 0x2A
+
+SdioCard card;
+bool enabled = false;
+
+bool write(const uint8_t *writebuff, uint32_t startSector, uint16_t numSectors) {
+  return card.writeBlocks(startSector, writebuff, numSectors);
+}
+
+bool read(uint8_t *readbuff, uint32_t startSector, uint16_t numSectors) {
+  return card.readBlocks(startSector, readbuff, numSectors);
+}
+
+bool readStart(uint8_t *readbuff, uint32_t startSector, uint16_t numSectors) {
+  return sdioReadBlocksStart(&card, startSector, readbuff, numSectors);
+}
+
+bool writeStart(const uint8_t *writebuff, uint32_t startSector, uint16_t numSectors) {
+  return sdioWriteBlocksStart(&card, startSector, writebuff, numSectors);
+}
+
+bool finish() {
+  return sdioFinish();
+}
+
+void setup() {
+  USBComposite.setProductId(PRODUCT_ID);
+  pinMode(LED_PIN,OUTPUT);
+  digitalWrite(LED_PIN,1);
+}
+
+void initReader() {
+  digitalWrite(LED_PIN,0);
+  MassStorage.setDriveData(0, card.cardSize(), read, write);
+  MassStorage.setDriveSplitPhase(0, readStart, writeStart, finish);
+  MassStorage.registerComponent();
+  USBComposite.begin();
+  while (!USBComposite);
+  enabled=true;
+}
+
+void loop() {
+  if (!enabled) {
+    if (card.begin()) {
+      initReader();
+    }
+    else {
+      delay(50);
+    }
+  }
+  else {
+    MassStorage.loop();
+  }
+}
@@ -29,21 +29,29 @@
 #define RANGE                      0x02
 #define CLOCK_SOURCE_ID            0x10
 #define AUDIO_INTERFACE_OFFSET     0x00
-#define IO_BUFFER_SIZE              256
-#define IO_BUFFER_SIZE_MASK         (IO_BUFFER_SIZE - 1)
+#define IO_BUFFER_SIZE             USB_AUDIO_BUFFER_SIZE
+#define IO_BUFFER_SIZE_MASK        (IO_BUFFER_SIZE - 1)
+/* the buffer level is averaged over about 2^AUDIO_LEVEL_SHIFT frames */
+#define AUDIO_LEVEL_SHIFT          4
+/* feedback moves by one sample per frame for every 2^AUDIO_FEEDBACK_GAIN_SHIFT
+ * samples the speaker buffer is off half full */
+#define AUDIO_FEEDBACK_GAIN_SHIFT  6
 //#define AUDIO_INTERFACE_NUMBER     (AUDIO_INTERFACE_OFFSET + usbAUDIOPart.startInterface)
 #define AUDIO_ISO_EP_ENDPOINT_INFO (&usbAUDIOPart.endpoints[0])
 #define AUDIO_ISO_EP_ADDRESS       (usbAUDIOPart.endpoints[0].address)
 #define AUDIO_ISO_PMA_BUFFER_SIZE  (usbAUDIOPart.endpoints[0].pmaSize / 2)
-
-/* Tx data */
-static volatile uint8 audioBufferTx[IO_BUFFER_SIZE];
+#define AUDIO_FEEDBACK_ENDPOINT_INFO (&usbAUDIOPart.endpoints[1])
+#define AUDIO_FEEDBACK_ADDRESS     (usbAUDIOPart.endpoints[1].address)
+
+/* A part is either a microphone or a speaker, so both directions share
+ * one buffer */
+static volatile uint8 audioBuffer[IO_BUFFER_SIZE];
+#define audioBufferTx audioBuffer
+#define audioBufferRx audioBuffer
 /* Write index to audioBufferTx */
 static volatile uint32 audio_tx_head = 0;
 /* Read index from audioBufferTx */
 static volatile uint32 audio_tx_tail = 0;
-/* Rx data */
-static volatile uint8 audioBufferRx[IO_BUFFER_SIZE];
 /* Write index to audioBufferRx */
 static volatile uint32 audio_rx_head = 0;
 /* Read index from audioBufferRx */
@@ -55,6 +63,14 @@ static uint8  clock_valid = 1;
 static uint16 sample_rate;
 static uint8  buffer_size;
 static uint8  channels;
+/* largest packet: one sample frame over the nominal rate, rounded up */
+static uint16 max_packet_size;
+/* microphone: thousandths of a sample frame carried over to the next packet */
+static uint16 frame_remainder;
+/* buffer level in bytes, times 2^AUDIO_LEVEL_SHIFT */
+static volatile uint32 buffer_level;
+/* speaker: samples per frame in 10.14 format, as last reported to the host */
+static volatile uint32 feedback;
 
 typedef struct {
     uint16_t wNumSubRanges;
@@ -72,6 +88,7 @@ static srr_data sample_rate_range = {
 
 static void audioDataTxCb(void);
 static void audioDataRxCb(void);
+static void audioFeedbackTxCb(void);
 static void audioUSBReset(void);
 static RESULT audioUSBDataSetup(uint8 request, uint8 interface, uint8 requestType, uint8 wValue0, uint8 wValue1, uint16 wIndex, uint16 wLength);
 static void (*packet_callback)(uint8) = 0;
@@ -93,6 +110,7 @@ typedef struct {
     audio_format_type_descriptor               AUDIO_Format_Type;
     audio_iso_endpoint_descriptor              AUDIO_Iso_EP;
     audio_iso_ac_endpoint_descriptor           AUDIO_Iso_EP_AC;
+    audio_iso_endpoint_descriptor              AUDIO_Feedback_EP; /* speaker only, must be last */
 } __packed audio_part_config;
 
 typedef struct {
@@ -109,6 +127,7 @@ typedef struct {
     audio_format_type_descriptor_2             AUDIO_Format_Type;
     audio_iso_endpoint_descriptor_2            AUDIO_Iso_EP;
     audio_iso_ac_endpoint_descriptor_2         AUDIO_Iso_EP_AC;
+    audio_iso_endpoint_descriptor_2            AUDIO_Feedback_EP; /* speaker only, must be last */
 } __packed audio_part_config_2;
 
 static const audio_part_config audioPartConfigData = {
@@ -235,7 +254,17 @@ static const audio_part_config audioPartConfigData = {
         .bmAttributes        = 0x00, /* no sampling control, no pitch control, no packet padding */
         .bLockDelayUnits     = 0x00, /* unused */
         .wLockDelay          = 0x0000, /* unused (0x0000) */
-    } /* 7 */
+    }, /* 7 */
+    .AUDIO_Feedback_EP = {
+        .bLength             = sizeof(audio_iso_endpoint_descriptor),
+        .bDescriptorType     = USB_DESCRIPTOR_TYPE_ENDPOINT, /* endpoint */
+        .bEndpointAddress    = USB_DESCRIPTOR_ENDPOINT_IN, /* IN endpoint - PATCH */
+        .bmAttributes        = USB_EP_TYPE_ISO | 0x10, /* isochronous, feedback */
+        .wMaxPacketSize      = AUDIO_FEEDBACK_SIZE, /* 10.14 samples per frame */
+        .bInterval           = 0x01, /* must be 1 for audio class 1 */
+        .bRefresh            = AUDIO_FEEDBACK_REFRESH, /* polled every 2^bRefresh ms */
+        .bSynchAddress       = 0x00, /* unused */
+    } /* 9 */
 };
 
 static const audio_part_config_2 audioPartConfigData2 = {
@@ -373,7 +402,15 @@ static const audio_part_config_2 audioPartConfigData2 = {
         .bmControls          = 0x00,
         .bLockDelayUnits     = 0x00,
         .wLockDelay          = 0x0000,
-    } /* 8 */
+    }, /* 8 */
+    .AUDIO_Feedback_EP = {
+        .bLength             = sizeof(audio_iso_endpoint_descriptor_2),
+        .bDescriptorType     = USB_DESCRIPTOR_TYPE_ENDPOINT, /* endpoint */
+        .bEndpointAddress    = USB_DESCRIPTOR_ENDPOINT_IN, /* IN endpoint - PATCH */
+        .bmAttributes        = USB_EP_TYPE_ISO | 0x10, /* isochronous, feedback */
+        .wMaxPacketSize      = AUDIO_FEEDBACK_SIZE, /* 10.14 samples per frame at full speed */
+        .bInterval           = AUDIO_FEEDBACK_REFRESH + 1, /* polled every 2^(bInterval-1) ms */
+    } /* 7 */
 };
 
 static USBEndpointInfo audioEndpointIN[1] = {
@@ -387,7 +424,7 @@ static USBEndpointInfo audioEndpointIN[1] = {
     }
 };
 
-static USBEndpointInfo audioEndpointOUT[1] = {
+static USBEndpointInfo audioEndpointOUT[2] = {
     {
         .callback = audioDataRxCb,
         .pmaSize = AUDIO_MAX_EP_BUFFER_SIZE,
@@ -395,18 +432,24 @@ static USBEndpointInfo audioEndpointOUT[1] = {
         .tx = 0,
         .exclusive = 1, // TODO: check if needed?
 		.doubleBuffer = 1
+    },
+    {
+        .callback = audioFeedbackTxCb,
+        .pmaSize = 2 * 4, /* two buffers of AUDIO_FEEDBACK_SIZE, rounded up */
+        .type = USB_GENERIC_ENDPOINT_TYPE_ISO,
+        .tx = 1,
+        .exclusive = 1,
+		.doubleBuffer = 1
     }
 };
 
 void usb_audio_setEPSize(uint32_t size) {
-    if (size == 0 || size > buffer_size)
-        size = buffer_size;
-
-    /* only IN is double buffered */
-    if (usbAUDIOPart.endpoints == audioEndpointIN)
-        size *= 2;
+    if (size == 0 || size > max_packet_size)
+        size = max_packet_size;
 
-    usbAUDIOPart.endpoints[0].pmaSize = size;
+    /* isochronous endpoints are double buffered both ways, and the second
+     * buffer has to start on a halfword */
+    usbAUDIOPart.endpoints[0].pmaSize = (size + 1) / 2 * 2 * 2;
 }
 
 #define OUT_BYTE(s,v) out[(uint8*)&(s.v)-(uint8*)&s]
@@ -428,9 +471,14 @@ static void getAUDIOPartDescriptor(uint8* out) {
     OUT_BYTE(audioPartConfigData, AUDIO_Format_Type.tSamFreq0) = AUDIO_SAMPLE_FREQ_0(sample_rate);
     OUT_BYTE(audioPartConfigData, AUDIO_Format_Type.tSamFreq1) = AUDIO_SAMPLE_FREQ_1(sample_rate);
     OUT_BYTE(audioPartConfigData, AUDIO_Format_Type.tSamFreq2) = AUDIO_SAMPLE_FREQ_2(sample_rate);
-    OUT_BYTE(audioPartConfigData, AUDIO_Iso_EP.bmAttributes) |= 0x0C; /* synchronous */
+    OUT_BYTE(audioPartConfigData, AUDIO_Iso_EP.bmAttributes) |= 0x04; /* asynchronous */
     /* Used in conjunction with other attributes for bandwidth allocation calculation */
-    OUT_16(audioPartConfigData, AUDIO_Iso_EP.wMaxPacketSize) = buffer_size;
+    OUT_16(audioPartConfigData, AUDIO_Iso_EP.wMaxPacketSize) = max_packet_size;
+    if (usbAUDIOPart.endpoints == audioEndpointOUT) {
+        OUT_BYTE(audioPartConfigData, AUDIO_Alternate1.bNumEndpoints) = 2;
+        OUT_BYTE(audioPartConfigData, AUDIO_Iso_EP.bSynchAddress) = USB_DESCRIPTOR_ENDPOINT_IN + AUDIO_FEEDBACK_ADDRESS;
+        OUT_BYTE(audioPartConfigData, AUDIO_Feedback_EP.bEndpointAddress) += AUDIO_FEEDBACK_ADDRESS;
+    }
 }
 
 static void getAUDIOPartDescriptor2(uint8* out) {
@@ -448,9 +496,13 @@ static void getAUDIOPartDescriptor2(uint8* out) {
     OUT_BYTE(audioPartConfigData2, AUDIO_Alternate1.bInterfaceNumber) += usbAUDIOPart.startInterface;
     OUT_BYTE(audioPartConfigData2, AUDIO_Iso_EP.bEndpointAddress) += AUDIO_ISO_EP_ADDRESS;
     OUT_BYTE(audioPartConfigData2, AUDIO_AS_AC.bNrChannels) = channels;
-    OUT_BYTE(audioPartConfigData2, AUDIO_Iso_EP.bmAttributes) |= 0x0C; /* synchronous */
+    OUT_BYTE(audioPartConfigData2, AUDIO_Iso_EP.bmAttributes) |= 0x04; /* asynchronous */
     /* Used in conjunction with other attributes for bandwidth allocation calculation */
-    OUT_16(audioPartConfigData2, AUDIO_Iso_EP.wMaxPacketSize) = buffer_size;
+    OUT_16(audioPartConfigData2, AUDIO_Iso_EP.wMaxPacketSize) = max_packet_size;
+    if (usbAUDIOPart.endpoints == audioEndpointOUT) {
+        OUT_BYTE(audioPartConfigData2, AUDIO_Alternate1.bNumEndpoints) = 2;
+        OUT_BYTE(audioPartConfigData2, AUDIO_Feedback_EP.bEndpointAddress) += AUDIO_FEEDBACK_ADDRESS;
+    }
 }
 
 USBCompositePart usbAUDIOPart = {
@@ -468,6 +520,7 @@ USBCompositePart usbAUDIOPart = {
 uint8 usb_audio_init(uint16 type, uint16 rate)
 {
     channels = 1;
+    usbAUDIOPart.numEndpoints = 1;
 
     if ((type & 0xFF) == MIC_MONO) {
         usbAUDIOPart.endpoints = audioEndpointIN;
@@ -476,21 +529,28 @@ uint8 usb_audio_init(uint16 type, uint16 rate)
         channels = 2;
     } else if ((type & 0xFF) == SPEAKER_MONO) {
         usbAUDIOPart.endpoints = audioEndpointOUT;
+        usbAUDIOPart.numEndpoints = 2;
     } else if ((type & 0xFF) == SPEAKER_STEREO) {
         usbAUDIOPart.endpoints = audioEndpointOUT;
+        usbAUDIOPart.numEndpoints = 2;
         channels = 2;
     }
     if ((type & 0xFF00) == AUDIO_CLASS_2) {
         usbAUDIOPart.descriptorSize = sizeof(audio_part_config_2);
+        if (usbAUDIOPart.numEndpoints == 1)
+            usbAUDIOPart.descriptorSize -= sizeof(audio_iso_endpoint_descriptor_2);
         usbAUDIOPart.getPartDescriptor = getAUDIOPartDescriptor2;
     } else if (((type & 0xFF00) == AUDIO_CLASS_1) || !(type & 0xFF00)) {
         usbAUDIOPart.descriptorSize = sizeof(audio_part_config);
+        if (usbAUDIOPart.numEndpoints == 1)
+            usbAUDIOPart.descriptorSize -= sizeof(audio_iso_endpoint_descriptor);
         usbAUDIOPart.getPartDescriptor = getAUDIOPartDescriptor;
     } else {
         return 0;
     }
 
     buffer_size = (rate / 1000) * channels;
+    max_packet_size = ((rate + 999) / 1000 + 1) * channels;
 
     sample_rate = rate;
 
@@ -499,13 +559,58 @@ uint8 usb_audio_init(uint16 type, uint16 rate)
     sample_rate_range.max           = sample_rate;
     sample_rate_range.res           = 0x00000000;
 
-    return buffer_size;
+    return max_packet_size;
 }
 
 void audio_set_packet_callback(void (*callback)(uint8)) {
         packet_callback = callback;
 }
 
+/* Bytes waiting in the buffer: not yet sent for a microphone, not yet
+ * read for a speaker. The rate control aims for half the buffer. */
+uint32 usb_audio_get_buffer_level(void)
+{
+    if (usbAUDIOPart.endpoints == audioEndpointOUT)
+        return (audio_rx_head - audio_rx_tail) & IO_BUFFER_SIZE_MASK;
+    else
+        return (audio_tx_head - audio_tx_tail) & IO_BUFFER_SIZE_MASK;
+}
+
+/* Speaker only: the rate last asked of the host, in samples per frame
+ * as 10.14 fixed point. */
+uint32 usb_audio_get_feedback(void)
+{
+    return feedback;
+}
+
+static void audio_update_level(uint32 level)
+{
+    buffer_level += level - (buffer_level >> AUDIO_LEVEL_SHIFT);
+}
+
+/* Bytes above (positive) or below half full, on average */
+static int32 audio_level_error(void)
+{
+    return (int32)(buffer_level >> AUDIO_LEVEL_SHIFT) - IO_BUFFER_SIZE / 2;
+}
+
+/* The host's rate is nominal plus a trim proportional to how far the
+ * buffer is from half full, so that on average it sends exactly as many
+ * samples as the application takes. */
+static uint32 audio_feedback_value(void)
+{
+    int32 nominal = ((uint32)sample_rate << 14) / 1000;
+    int32 trim = -audio_level_error() * (1 << (14 - AUDIO_FEEDBACK_GAIN_SHIFT)) / channels;
+
+    /* keep within what hosts will accept */
+    if (trim > nominal / 64)
+        trim = nominal / 64;
+    else if (trim < -nominal / 64)
+        trim = -nominal / 64;
+
+    return nominal + trim;
+}
+
 /* This function is non-blocking.
  *
  * It copies data from a user buffer into the USB peripheral TX
@@ -578,15 +683,45 @@ uint32 usb_audio_read_rx_data(uint8* buf, uint32 len)
     return n_copied;
 }
 
-/* Since we're USB FS, this function called once per millisecond */
+/* Since we're USB FS, this function called once per millisecond.
+ *
+ * The endpoint is asynchronous: the packet carries as many samples as
+ * our own clock has produced, so the fractional part of the rate is
+ * carried from frame to frame, and a frame more or less is sent while
+ * the buffer is more than half a packet off half full. */
 static void audioDataTxCb(void)
 {
+    uint32 unsent = (audio_tx_head - audio_tx_tail) & IO_BUFFER_SIZE_MASK;
+    uint32 frames = sample_rate / 1000;
+    uint32 amount;
+    int32 error;
+
+    frame_remainder += sample_rate % 1000;
+    if (frame_remainder >= 1000) {
+        frame_remainder -= 1000;
+        frames++;
+    }
+
+    audio_update_level(unsent);
+    error = audio_level_error();
+    if (error > buffer_size / 2)
+        frames++;
+    else if (error < -(buffer_size / 2) && frames > 0)
+        frames--;
+
+    amount = frames * channels;
+    if (amount > max_packet_size)
+        amount = max_packet_size;
+    /* underrun: send whole sample frames only */
+    if (amount > unsent)
+        amount = unsent - unsent % channels;
+
     transmitting = 1;
-    usb_generic_send_from_circular_buffer_double_buffered(AUDIO_ISO_EP_ENDPOINT_INFO, audioBufferTx, IO_BUFFER_SIZE, buffer_size, &audio_tx_tail);
+    usb_generic_send_from_circular_buffer_double_buffered(AUDIO_ISO_EP_ENDPOINT_INFO, audioBufferTx, IO_BUFFER_SIZE, amount, &audio_tx_tail);
     transmitting = -1;
 
     if (packet_callback)
-        packet_callback(buffer_size);
+        packet_callback(amount);
 }
 
 static void audioDataRxCb(void)
@@ -596,10 +731,27 @@ static void audioDataRxCb(void)
                         IO_BUFFER_SIZE, &audio_rx_head);
     usbAudioReceiving = 0;
 
+    audio_update_level((audio_rx_head - audio_rx_tail) & IO_BUFFER_SIZE_MASK);
+
     if (packet_callback)
         packet_callback(ep_rx_size);
 }
 
+/* Both buffers get the latest value, so it doesn't matter which one the
+ * host reads next. */
+static void audioFeedbackTxCb(void)
+{
+    USBEndpointInfo* ep = AUDIO_FEEDBACK_ENDPOINT_INFO;
+    uint32 value = audio_feedback_value();
+    uint8 packet[4] = { value, value >> 8, value >> 16, 0 };
+
+    feedback = value;
+    usb_copy_to_pma_ptr(packet, AUDIO_FEEDBACK_SIZE, PMA_PTR_BUF0(ep));
+    usb_copy_to_pma_ptr(packet, AUDIO_FEEDBACK_SIZE, PMA_PTR_BUF1(ep));
+    usb_set_ep_tx_buf0_count(ep->address, AUDIO_FEEDBACK_SIZE);
+    usb_set_ep_tx_buf1_count(ep->address, AUDIO_FEEDBACK_SIZE);
+}
+
 static void audioUSBReset(void) {
     /* Reset the RX/TX state */
     audio_tx_head = 0;
@@ -608,13 +760,17 @@ static void audioUSBReset(void) {
     audio_rx_tail = 0;
     usbAudioReceiving = 0;
     transmitting = -1;
+    frame_remainder = 0;
+    buffer_level = (IO_BUFFER_SIZE / 2) << AUDIO_LEVEL_SHIFT;
 
     if (usbAUDIOPart.endpoints == audioEndpointIN) {
         /* Setup IN endpoint */
         usb_generic_enable_tx(AUDIO_ISO_EP_ENDPOINT_INFO);
     } else if (usbAUDIOPart.endpoints == audioEndpointOUT) {
-        /* Setup OUT endpoint */
+        /* Setup OUT endpoint, and the feedback endpoint with the nominal rate */
         usb_generic_enable_rx(AUDIO_ISO_EP_ENDPOINT_INFO);
+        audioFeedbackTxCb();
+        usb_generic_enable_tx(AUDIO_FEEDBACK_ENDPOINT_INFO);
     }
 }
 
@@ -57,6 +57,20 @@
 
 #define AUDIO_MAX_EP_BUFFER_SIZE                      128
 
+/* Sample ring buffer, in bytes; must be a power of two. The rate control
+ * keeps it about half full, so this sets the latency and how much jitter
+ * in the application's reads or writes can be absorbed. */
+#ifndef USB_AUDIO_BUFFER_SIZE
+#define USB_AUDIO_BUFFER_SIZE                         1024
+#endif
+#if USB_AUDIO_BUFFER_SIZE & (USB_AUDIO_BUFFER_SIZE - 1)
+#error USB_AUDIO_BUFFER_SIZE must be a power of two
+#endif
+
+/* Speaker feedback endpoint: the host polls it every 2^AUDIO_FEEDBACK_REFRESH ms */
+#define AUDIO_FEEDBACK_REFRESH                        3
+#define AUDIO_FEEDBACK_SIZE                           3 /* 10.14 samples per frame */
+
 #define AUDIO_CLASS_1                                 0x0100
 #define AUDIO_CLASS_2                                 0x1000
 #define MIC_MONO                                      0x01
@@ -312,6 +326,8 @@ uint32 usb_audio_read_rx_data(uint8* buf, uint32 len);
 uint8 usb_audio_init(uint16 type, uint16 rate);
 void usb_audio_setEPSize(uint32_t size);
 void audio_set_packet_callback(void (*callback)(uint8));
+uint32 usb_audio_get_buffer_level(void);
+uint32 usb_audio_get_feedback(void);
 
 #ifdef __cplusplus
 }
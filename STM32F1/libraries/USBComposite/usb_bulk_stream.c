@@ -0,0 +1,400 @@
+/* Copyright (c) 2011, Peter Barrett and 2019, Alexander Pruss
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+/**
+ * @brief Vendor-specific interface with one bulk IN and one bulk OUT
+ *        endpoint, moving whole application buffers.
+ *
+ * The application submits buffers (e.g. the halves of a DMA buffer) and
+ * gets a callback from the USB interrupt when each one is done, so data
+ * goes straight between its buffers and the PMA with no intermediate
+ * ring buffer. There's no framing: the host sees a plain byte stream.
+ */
+
+#include <string.h>
+
+#include "usb_generic.h"
+#include "usb_bulk_stream.h"
+
+#include <libmaple/usb.h>
+
+/* Private headers */
+#include "usb_lib_globals.h"
+#include "usb_reg_map.h"
+
+/* usb_lib headers */
+#include "usb_type.h"
+#include "usb_core.h"
+#include "usb_def.h"
+
+#define BULK_STREAM_ENDPOINT_TX 0
+#define BULK_STREAM_ENDPOINT_RX 1
+#define USB_BULK_STREAM_TX_ENDP (bulkStreamEndpoints[BULK_STREAM_ENDPOINT_TX].address)
+#define USB_BULK_STREAM_RX_ENDP (bulkStreamEndpoints[BULK_STREAM_ENDPOINT_RX].address)
+#define USB_BULK_STREAM_TX_ENDPOINT_INFO (&bulkStreamEndpoints[BULK_STREAM_ENDPOINT_TX])
+#define USB_BULK_STREAM_RX_ENDPOINT_INFO (&bulkStreamEndpoints[BULK_STREAM_ENDPOINT_RX])
+
+#define QUEUE_MASK (USB_BULK_STREAM_QUEUE_LENGTH-1)
+
+static void bulkStreamDataTxCb(void);
+static void bulkStreamDataRxCb(void);
+static void bulkStreamReset(void);
+
+typedef struct {
+    uint8* data;
+    uint32 length;
+    uint32 offset; // bytes already moved to or from the PMA
+} bulk_stream_buffer;
+
+// head and tail are free-running; the buffer at tail is the one in progress
+static bulk_stream_buffer txQueue[USB_BULK_STREAM_QUEUE_LENGTH];
+static bulk_stream_buffer rxQueue[USB_BULK_STREAM_QUEUE_LENGTH];
+static volatile uint32 tx_head;
+static volatile uint32 tx_tail;
+static volatile uint32 rx_head;
+static volatile uint32 rx_tail;
+static volatile int8 transmitting = -1; // 1 while a packet is on the endpoint
+static volatile uint8 receiving; // 1 while the Rx endpoint is VALID
+
+static USBBulkStreamCallback txDone = NULL;
+static USBBulkStreamCallback rxDone = NULL;
+static void* callbackExtra = NULL;
+
+static uint32 txEPSize = 64;
+static uint32 rxEPSize = 64;
+
+typedef struct {
+    usb_descriptor_interface Data_Interface;
+    usb_descriptor_endpoint DataInEndpoint;
+    usb_descriptor_endpoint DataOutEndpoint;
+} __packed bulk_stream_descriptor_config;
+
+static const bulk_stream_descriptor_config bulkStreamConfigDescriptor = {
+    .Data_Interface = {
+        .bLength            = sizeof(usb_descriptor_interface),
+        .bDescriptorType    = USB_DESCRIPTOR_TYPE_INTERFACE,
+        .bInterfaceNumber   = 0x00, // PATCH
+        .bAlternateSetting  = 0x00,
+        .bNumEndpoints      = 0x02,
+        .bInterfaceClass    = USB_BULK_STREAM_CLASS,
+        .bInterfaceSubClass = USB_BULK_STREAM_SUBCLASS,
+        .bInterfaceProtocol = USB_BULK_STREAM_PROTOCOL,
+        .iInterface         = 0,
+    },
+
+    .DataInEndpoint = {
+        .bLength          = sizeof(usb_descriptor_endpoint),
+        .bDescriptorType  = USB_DESCRIPTOR_TYPE_ENDPOINT,
+        .bEndpointAddress = (USB_DESCRIPTOR_ENDPOINT_IN | 0), // PATCH: USB_BULK_STREAM_TX_ENDP
+        .bmAttributes     = USB_EP_TYPE_BULK,
+        .wMaxPacketSize   = 64, // PATCH
+        .bInterval        = 0x00,
+    },
+
+    .DataOutEndpoint = {
+        .bLength          = sizeof(usb_descriptor_endpoint),
+        .bDescriptorType  = USB_DESCRIPTOR_TYPE_ENDPOINT,
+        .bEndpointAddress = (USB_DESCRIPTOR_ENDPOINT_OUT | 0), // PATCH: USB_BULK_STREAM_RX_ENDP
+        .bmAttributes     = USB_EP_TYPE_BULK,
+        .wMaxPacketSize   = 64, // PATCH
+        .bInterval        = 0x00,
+    },
+};
+
+static USBEndpointInfo bulkStreamEndpoints[2] = {
+    {
+        .callback = bulkStreamDataTxCb,
+        .pmaSize = 64, // patch
+        .type = USB_GENERIC_ENDPOINT_TYPE_BULK,
+        .tx = 1,
+        .canDoubleBuffer = 1,
+    },
+    {
+        .callback = bulkStreamDataRxCb,
+        .pmaSize = 64, // patch
+        .type = USB_GENERIC_ENDPOINT_TYPE_BULK,
+        .tx = 0,
+    },
+};
+
+#define OUT_BYTE(s,v) out[(uint8*)&(s.v)-(uint8*)&s]
+#define OUT_16(s,v) *(uint16_t*)&OUT_BYTE(s,v) // OK on Cortex which can handle unaligned writes
+
+static void getBulkStreamPartDescriptor(uint8* out) {
+    memcpy(out, &bulkStreamConfigDescriptor, sizeof(bulk_stream_descriptor_config));
+
+    // patch to reflect where the part goes in the descriptor
+    OUT_BYTE(bulkStreamConfigDescriptor, Data_Interface.bInterfaceNumber) += usbBulkStreamPart.startInterface;
+    OUT_BYTE(bulkStreamConfigDescriptor, DataInEndpoint.bEndpointAddress) += USB_BULK_STREAM_TX_ENDP;
+    OUT_BYTE(bulkStreamConfigDescriptor, DataOutEndpoint.bEndpointAddress) += USB_BULK_STREAM_RX_ENDP;
+    OUT_16(bulkStreamConfigDescriptor, DataInEndpoint.wMaxPacketSize) = txEPSize;
+    OUT_16(bulkStreamConfigDescriptor, DataOutEndpoint.wMaxPacketSize) = rxEPSize;
+}
+
+USBCompositePart usbBulkStreamPart = {
+    .numInterfaces = 1,
+    .numEndpoints = sizeof(bulkStreamEndpoints)/sizeof(*bulkStreamEndpoints),
+    .descriptorSize = sizeof(bulk_stream_descriptor_config),
+    .getPartDescriptor = getBulkStreamPartDescriptor,
+    .usbInit = NULL,
+    .usbReset = bulkStreamReset,
+    .usbDataSetup = NULL,
+    .usbNoDataSetup = NULL,
+    .endpoints = bulkStreamEndpoints
+};
+
+void usb_bulk_stream_setTXEPSize(uint32 size) {
+    if (size == 0 || size > 64)
+        size = 64;
+    bulkStreamEndpoints[BULK_STREAM_ENDPOINT_TX].pmaSize = size;
+    txEPSize = size;
+}
+
+void usb_bulk_stream_setRXEPSize(uint32 size) {
+    if (size == 0 || size > 64)
+        size = 64;
+    size = usb_generic_roundUpToPowerOf2(size);
+    bulkStreamEndpoints[BULK_STREAM_ENDPOINT_RX].pmaSize = size;
+    rxEPSize = size;
+}
+
+void usb_bulk_stream_set_callbacks(USBBulkStreamCallback _txDone, USBBulkStreamCallback _rxDone, void* extra) {
+    usb_generic_disable_interrupts_ep0();
+    txDone = _txDone;
+    rxDone = _rxDone;
+    callbackExtra = extra;
+    usb_generic_enable_interrupts_ep0();
+}
+
+/*
+ * Tx
+ */
+
+static inline uint8 tx_double_buffered(USBEndpointInfo* ep) {
+    return ep->doubleBuffer && ep->canDoubleBuffer;
+}
+
+// Copy the next packet of the buffer in progress to the PMA, retiring the
+// buffer once its last byte is copied. Returns the packet length, 0 if
+// nothing is queued.
+static uint32 tx_fill(uint32* pma) {
+    bulk_stream_buffer* b;
+    uint32 amount;
+
+    if (tx_head == tx_tail)
+        return 0;
+
+    b = &txQueue[tx_tail & QUEUE_MASK];
+    amount = b->length - b->offset;
+    if (amount > txEPSize)
+        amount = txEPSize;
+    usb_copy_to_pma_ptr(b->data + b->offset, amount, pma);
+    b->offset += amount;
+
+    if (b->offset >= b->length) {
+        tx_tail++;
+        if (txDone != NULL)
+            txDone(callbackExtra, b->data, b->length);
+    }
+
+    return amount;
+}
+
+// fill the packet buffer that SW_BUF says is ours
+static uint32 tx_stage(USBEndpointInfo* ep) {
+    uint32 amount;
+    if (usb_get_ep_tx_sw_buf(ep->address)) {
+        amount = tx_fill(PMA_PTR_BUF1(ep));
+        usb_set_ep_tx_buf1_count(ep->address, amount);
+    }
+    else {
+        amount = tx_fill(PMA_PTR_BUF0(ep));
+        usb_set_ep_tx_buf0_count(ep->address, amount);
+    }
+    return amount;
+}
+
+// Start the next packet; called with the endpoint idle, either from the Tx
+// callback or with interrupts masked.
+static void tx_send(void) {
+    USBEndpointInfo* ep = USB_BULK_STREAM_TX_ENDPOINT_INFO;
+    int32 amount;
+
+    if (!tx_double_buffered(ep)) {
+        amount = tx_fill(ep->pma);
+        if (amount == 0) {
+            transmitting = -1;
+            return;
+        }
+        transmitting = 1;
+        usb_generic_set_tx(ep, amount);
+        return;
+    }
+
+    // same handoff as send_from_circular_buffer_staged() in usb_generic.c:
+    // the packet staged while the previous one went out is sent at once,
+    // and the next one is staged behind it
+    amount = ep->txStaged;
+    ep->txStaged = -1;
+    if (amount < 0)
+        amount = tx_stage(ep);
+    if (amount == 0) {
+        transmitting = -1;
+        return;
+    }
+    transmitting = 1;
+    usb_toggle_ep_tx_sw_buf(ep->address);
+    usb_generic_enable_tx(ep);
+
+    amount = tx_stage(ep);
+    if (amount > 0)
+        ep->txStaged = amount;
+}
+
+static void bulkStreamDataTxCb(void) {
+    tx_send();
+}
+
+uint8 usb_bulk_stream_submit_tx(const uint8* buffer, uint32 length) {
+    USBEndpointInfo* ep = USB_BULK_STREAM_TX_ENDPOINT_INFO;
+    bulk_stream_buffer* b;
+    uint8 ok = 0;
+
+    if (length == 0)
+        return 0;
+
+    usb_generic_disable_interrupts_ep0();
+    if (tx_head - tx_tail < USB_BULK_STREAM_QUEUE_LENGTH) {
+        b = &txQueue[tx_head & QUEUE_MASK];
+        b->data = (uint8*)buffer;
+        b->length = length;
+        b->offset = 0;
+        tx_head++;
+        ok = 1;
+
+        // the endpoints are set up from the bus reset on, and the host
+        // won't poll them before it has configured us
+        if (usb_is_connected(USBLIB)) {
+            if (transmitting < 0) {
+                tx_send();
+            }
+            else if (tx_double_buffered(ep) && ep->txStaged < 0) {
+                // a packet is in flight but the spare buffer is empty
+                uint32 amount = tx_stage(ep);
+                if (amount > 0)
+                    ep->txStaged = amount;
+            }
+        }
+    }
+    usb_generic_enable_interrupts_ep0();
+
+    return ok;
+}
+
+uint32 usb_bulk_stream_tx_queued(void) {
+    return tx_head - tx_tail;
+}
+
+/*
+ * Rx
+ */
+
+// Leave the endpoint NAKing while there's nowhere to put a packet, so the
+// host waits instead of the data being dropped.
+static void rx_resume(void) {
+    if (rx_head != rx_tail) {
+        receiving = 1;
+        usb_generic_enable_rx(USB_BULK_STREAM_RX_ENDPOINT_INFO);
+    }
+    else {
+        receiving = 0;
+    }
+}
+
+static void bulkStreamDataRxCb(void) {
+    USBEndpointInfo* ep = USB_BULK_STREAM_RX_ENDPOINT_INFO;
+    uint32 count = usb_get_ep_rx_count(ep->address);
+
+    if (rx_head != rx_tail) {
+        bulk_stream_buffer* b = &rxQueue[rx_tail & QUEUE_MASK];
+        uint32 room = b->length - b->offset;
+
+        // anything that doesn't fit is lost; keep Rx buffers a multiple
+        // of the packet size
+        usb_copy_from_pma_ptr(b->data + b->offset, count < room ? count : room, ep->pma);
+        b->offset += count < room ? count : room;
+
+        // a short packet ends the host's transfer
+        if (b->offset >= b->length || count < rxEPSize) {
+            rx_tail++;
+            if (rxDone != NULL)
+                rxDone(callbackExtra, b->data, b->offset);
+        }
+    }
+
+    rx_resume();
+}
+
+uint8 usb_bulk_stream_submit_rx(uint8* buffer, uint32 length) {
+    bulk_stream_buffer* b;
+    uint8 ok = 0;
+
+    if (length == 0)
+        return 0;
+
+    usb_generic_disable_interrupts_ep0();
+    if (rx_head - rx_tail < USB_BULK_STREAM_QUEUE_LENGTH) {
+        b = &rxQueue[rx_head & QUEUE_MASK];
+        b->data = buffer;
+        b->length = length;
+        b->offset = 0;
+        rx_head++;
+        ok = 1;
+
+        if (!receiving && usb_is_connected(USBLIB))
+            rx_resume();
+    }
+    usb_generic_enable_interrupts_ep0();
+
+    return ok;
+}
+
+uint32 usb_bulk_stream_rx_queued(void) {
+    return rx_head - rx_tail;
+}
+
+// Buffers queued before the host configured us (or across a bus reset) stay
+// queued; the ones in progress start over.
+static void bulkStreamReset(void) {
+    if (tx_head != tx_tail)
+        txQueue[tx_tail & QUEUE_MASK].offset = 0;
+    if (rx_head != rx_tail)
+        rxQueue[rx_tail & QUEUE_MASK].offset = 0;
+
+    // the host won't ask for data until it has configured us, so the
+    // first packet can be armed right away
+    transmitting = -1;
+    tx_send();
+
+    // usbReset() in usb_generic.c left the Rx endpoint VALID
+    if (rx_head != rx_tail) {
+        receiving = 1;
+    }
+    else {
+        receiving = 0;
+        usb_generic_pause_rx(USB_BULK_STREAM_RX_ENDPOINT_INFO);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef _USB_BULK_STREAM_H_
+#define _USB_BULK_STREAM_H_
+
+#include <libmaple/libmaple_types.h>
+#include <libmaple/usb.h>
+#include "usb_generic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Buffers that can be submitted ahead in each direction; must be a power of 2
+#ifndef USB_BULK_STREAM_QUEUE_LENGTH
+#define USB_BULK_STREAM_QUEUE_LENGTH 4
+#endif
+#if (USB_BULK_STREAM_QUEUE_LENGTH & (USB_BULK_STREAM_QUEUE_LENGTH-1)) != 0
+# error USB_BULK_STREAM_QUEUE_LENGTH must be a power of 2
+#endif
+
+#define USB_BULK_STREAM_CLASS     0xFF // vendor specific
+#define USB_BULK_STREAM_SUBCLASS  0x00
+#define USB_BULK_STREAM_PROTOCOL  0x00
+
+// Called from the USB interrupt when a submitted buffer is finished with.
+// For TX, length is the number of bytes handed to the USB peripheral, and the
+// buffer may be refilled as soon as the call is made. For RX, length is the
+// number of bytes received.
+typedef void (*USBBulkStreamCallback)(void* extra, uint8* buffer, uint32 length);
+
+extern USBCompositePart usbBulkStreamPart;
+
+void usb_bulk_stream_setTXEPSize(uint32 size);
+void usb_bulk_stream_setRXEPSize(uint32 size);
+void usb_bulk_stream_set_callbacks(USBBulkStreamCallback txDone, USBBulkStreamCallback rxDone, void* extra);
+uint8 usb_bulk_stream_submit_tx(const uint8* buffer, uint32 length);
+uint8 usb_bulk_stream_submit_rx(uint8* buffer, uint32 length);
+uint32 usb_bulk_stream_tx_queued(void);
+uint32 usb_bulk_stream_rx_queued(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -195,6 +195,7 @@ static USBEndpointInfo serialEndpoints[3] = {
         .callback = vcomDataTxCb,
         .pmaSize = 64, // patch
         .type = USB_GENERIC_ENDPOINT_TYPE_BULK,
+        .canDoubleBuffer = 1,
         .tx = 1,
     },
     {
@@ -207,6 +208,7 @@ static USBEndpointInfo serialEndpoints[3] = {
         .callback = vcomDataRxCb,
         .pmaSize = 64, // patch
         .type = USB_GENERIC_ENDPOINT_TYPE_BULK,
+        .canDoubleBuffer = 1,
         .tx = 0,
     },
 };
@@ -312,6 +314,8 @@ uint32 composite_cdcacm_tx(const uint8* buf, uint32 len)
 {
 	if (len==0) return 0; // no data to send
 
+	usb_generic_disable_interrupts_ep0();
+
 	uint32 head = vcom_tx_head; // load volatile variable
 	uint32 tx_unsent = (head - vcom_tx_tail) & CDC_SERIAL_TX_BUFFER_SIZE_MASK;
 
@@ -319,7 +323,6 @@ uint32 composite_cdcacm_tx(const uint8* buf, uint32 len)
     if (len > (CDC_SERIAL_TX_BUFFER_SIZE-tx_unsent-1) ) {
         len = (CDC_SERIAL_TX_BUFFER_SIZE-tx_unsent-1);
     }
-	if (len==0) return 0; // buffer full
 
 	uint16 i;
 	// copy data from user buffer to USB Tx buffer
@@ -328,13 +331,14 @@ uint32 composite_cdcacm_tx(const uint8* buf, uint32 len)
 		head = (head+1) & CDC_SERIAL_TX_BUFFER_SIZE_MASK;
 	}
 	vcom_tx_head = head; // store volatile variable
-	
-	while(transmitting >= 0);
-	
-	if (transmitting < 0) {
+
+	// if the endpoint is busy, the completion callback picks up the new bytes
+	if (len>0 && transmitting < 0) {
 		vcomDataTxCb(); // initiate data transmission
 	}
 
+	usb_generic_enable_interrupts_ep0();
+
     return len;
 }
 
@@ -464,8 +468,8 @@ static void vcomDataTxCb(void)
 static void vcomDataRxCb(void)
 {
 	uint32 head = vcom_rx_head;
-    usb_generic_read_to_circular_buffer(USB_CDCACM_RX_ENDPOINT_INFO,
-                            vcomBufferRx, CDC_SERIAL_RX_BUFFER_SIZE, &head);
+    usb_generic_read_to_circular_buffer_ahead(USB_CDCACM_RX_ENDPOINT_INFO,
+                            vcomBufferRx, CDC_SERIAL_RX_BUFFER_SIZE, &head, vcom_rx_tail);
 	vcom_rx_head = head; // store volatile variable
 
 	uint32 rx_unread = (head - vcom_rx_tail) & CDC_SERIAL_RX_BUFFER_SIZE_MASK;
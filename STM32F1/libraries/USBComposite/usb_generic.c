@@ -215,15 +215,21 @@ static void (*ep_int_in[7])(void);
 static void (*ep_int_out[7])(void);
 
 static uint8 minimum_address;
+static uint8 exclusive_double_buffers;
+static uint16 pma_used;
+
+static uint8 is_exclusive(USBEndpointInfo* ep) {
+    return ep->exclusive || (exclusive_double_buffers && ep->canDoubleBuffer);
+}
 
 static uint8 acceptable_endpoint_number(unsigned partNum, unsigned endpointNum, uint8 address) {
     USBEndpointInfo* ep = &(parts[partNum]->endpoints[endpointNum]);
     for (unsigned i = 0 ; i <= partNum ; i++)
-        for(unsigned j = 0 ; (i < partNum && j < parts[partNum]->numEndpoints) || (i == partNum && j < endpointNum) ; j++) {
+        for(unsigned j = 0 ; (i < partNum && j < parts[i]->numEndpoints) || (i == partNum && j < endpointNum) ; j++) {
             USBEndpointInfo* ep1 = &(parts[i]->endpoints[j]);
             if (ep1->address != address)
                 continue;
-            if (ep1->tx == ep->tx || ep->exclusive || ep1->exclusive || ep1->type != ep->type || ep1->doubleBuffer != ep->doubleBuffer)
+            if (ep1->tx == ep->tx || is_exclusive(ep) || is_exclusive(ep1) || ep1->type != ep->type || ep1->doubleBuffer != ep->doubleBuffer)
                 return 0;
         }
     return 1;
@@ -236,12 +242,81 @@ static int8 allocate_endpoint_address(unsigned partNum, unsigned endpointNum) {
     return -1;
 }
 
+// PMA bytes taken by an endpoint, rounded as the hardware requires
+static uint32 pma_footprint(USBEndpointInfo* ep) {
+    uint32 size = ep->pmaSize;
+    if (ep->doubleBuffer && ep->canDoubleBuffer)
+        size *= 2;
+    // rx has special length alignment issues
+    if (ep->doubleBuffer) {
+        if (size <= 124 || ep->tx) {
+            size = (size+3)/4*4;
+        }
+        else {
+            size = (size+63)/64*64;
+        }
+    }
+    else {
+        if (size <= 62 || ep->tx) {
+            size = (size+1)/2*2;
+        }
+        else {
+            size = (size+31)/32*32;
+        }
+    }
+    return size;
+}
+
+static uint8 endpoint_address_shared(USBEndpointInfo* ep) {
+    for (unsigned i = 0 ; i < numParts ; i++)
+        for (unsigned j = 0 ; j < parts[i]->numEndpoints ; j++) {
+            USBEndpointInfo* ep1 = &(parts[i]->endpoints[j]);
+            if (ep1 != ep && ep1->address == ep->address)
+                return 1;
+        }
+    return 0;
+}
+
+// returns the highest endpoint number used, or -1 if there aren't enough
+static int8 assign_endpoint_addresses(void) {
+    int8 maxAddress = 0;
+    minimum_address = 1;
+    for (unsigned i = 0 ; i < numParts ; i++ ) {
+        USBEndpointInfo* ep = parts[i]->endpoints;
+        for (unsigned j = 0 ; j < parts[i]->numEndpoints ; j++)
+            ep[j].address = 0;
+    }
+    for (unsigned i = 0 ; i < numParts ; i++ ) {
+        USBEndpointInfo* ep = parts[i]->endpoints;
+        for (unsigned j = 0 ; j < parts[i]->numEndpoints ; j++) {
+            if (ep[j].align) 
+                minimum_address = maxAddress + 1;
+            int8 address = allocate_endpoint_address(i, j);
+            if (address < 0)
+                return -1;
+            ep[j].address = address;
+            if (maxAddress < address)
+                maxAddress = address;
+        }
+#ifdef MATCHING_ENDPOINT_RANGES        
+        minimum_address = maxAddress + 1;
+#endif
+    }
+    return maxAddress;
+}
+
+/* Lays out the packet memory in two passes. The first sizes every
+ * endpoint single-buffered (apart from those a part double-buffers
+ * itself). The second spends what's left of the 512 bytes on double
+ * buffering the bulk endpoints that allow it, in part order, so the
+ * parts added first get the throughput. Double-buffered endpoints
+ * can't share their number, so they get endpoint numbers of their
+ * own if there are enough to go round. */
 uint8 usb_generic_set_parts(USBCompositePart** _parts, unsigned _numParts) {
     parts = _parts;
     numParts = _numParts;
     unsigned numInterfaces = 0;
-    minimum_address = 1;
-    uint8 maxAddress = 0;
+    int8 maxAddress;
 
     uint16 usbDescriptorSize = 0;
     uint16 pmaOffset = USB_EP0_RX_BUFFER_ADDRESS + USB_EP0_BUFFER_SIZE;
@@ -251,6 +326,51 @@ uint8 usb_generic_set_parts(USBCompositePart** _parts, unsigned _numParts) {
         ep_int_out[i] = NOP_Process;
     }
     
+    // double buffering is decided afresh each time
+    for (unsigned i = 0 ; i < _numParts ; i++ ) {
+        USBEndpointInfo* ep = parts[i]->endpoints;
+        for (unsigned j = 0 ; j < parts[i]->numEndpoints ; j++)
+            if (ep[j].canDoubleBuffer)
+                ep[j].doubleBuffer = 0;
+    }
+
+    exclusive_double_buffers = 1;
+    maxAddress = assign_endpoint_addresses();
+    if (maxAddress < 0) {
+        exclusive_double_buffers = 0;
+        maxAddress = assign_endpoint_addresses();
+        if (maxAddress < 0)
+            return 0;
+    }
+
+    // first pass: single buffers
+    for (unsigned i = 0 ; i < _numParts ; i++ ) {
+        USBEndpointInfo* ep = parts[i]->endpoints;
+        for (unsigned j = 0 ; j < parts[i]->numEndpoints ; j++)
+            pmaOffset += pma_footprint(&ep[j]);
+    }
+    if (pmaOffset > PMA_MEMORY_SIZE)
+        return 0;
+
+    // second pass: double buffers while there is room
+    for (unsigned i = 0 ; i < _numParts ; i++ ) {
+        USBEndpointInfo* ep = parts[i]->endpoints;
+        for (unsigned j = 0 ; j < parts[i]->numEndpoints ; j++) {
+            if (!ep[j].canDoubleBuffer || ep[j].type != USB_GENERIC_ENDPOINT_TYPE_BULK ||
+                endpoint_address_shared(&ep[j]))
+                continue;
+            uint32 single = pma_footprint(&ep[j]);
+            ep[j].doubleBuffer = 1;
+            uint32 extra = pma_footprint(&ep[j]) - single;
+            if (pmaOffset + extra > PMA_MEMORY_SIZE)
+                ep[j].doubleBuffer = 0;
+            else
+                pmaOffset += extra;
+        }
+    }
+    pma_used = pmaOffset;
+
+    pmaOffset = USB_EP0_RX_BUFFER_ADDRESS + USB_EP0_BUFFER_SIZE;
     usbDescriptorSize = 0;
     for (unsigned i = 0 ; i < _numParts ; i++ ) {
         USBCompositePart* part = parts[i];
@@ -261,51 +381,20 @@ uint8 usb_generic_set_parts(USBCompositePart** _parts, unsigned _numParts) {
 		}
         USBEndpointInfo* ep = part->endpoints;
         for (unsigned j = 0 ; j < part->numEndpoints ; j++) {
-            if (ep[j].align) 
-                minimum_address = maxAddress + 1;
-            int8 address = allocate_endpoint_address(i, j);
-            if (address < 0)
-                return 0;
-
             ep[j].pma = usb_pma_ptr(pmaOffset);
-            uint32 size = ep[j].pmaSize;
-            // rx has special length alignment issues
-            if (ep[j].doubleBuffer) {
-                if (size <= 124 || ep[j].tx) {
-                    size = (size+3)/4*4;
-                }
-                else {
-                    size = (size+63)/64*64;
-                }
-            }
-            else {
-                if (size <= 62 || ep[j].tx) {
-                    size = (size+1)/2*2;
-                }
-                else {
-                    size = (size+31)/32*32;
-                }
-            }
-            pmaOffset += size;
-            if (pmaOffset > PMA_MEMORY_SIZE)
-                return 0;
+            pmaOffset += pma_footprint(&ep[j]);
             if (ep[j].callback == NULL)
                 ep[j].callback = NOP_Process;
-            ep[j].address = address;
+            uint8 address = ep[j].address;
             if (ep[j].tx) {
                 ep_int_in[address-1] = ep[j].callback;
             }
             else {
                 ep_int_out[address-1] = ep[j].callback;
             }
-            if (maxAddress < address)
-                maxAddress = address;
         }
         part->getPartDescriptor(usbConfig.descriptorData + usbDescriptorSize);
         usbDescriptorSize += part->descriptorSize;
-#ifdef MATCHING_ENDPOINT_RANGES        
-        minimum_address = maxAddress + 1;
-#endif
     }
     
     usbConfig.Config_Header = Base_Header;    
@@ -318,6 +407,14 @@ uint8 usb_generic_set_parts(USBCompositePart** _parts, unsigned _numParts) {
     return 1;
 }
 
+uint16 usb_generic_pma_used(void) {
+    return pma_used;
+}
+
+uint16 usb_generic_pma_offset(USBEndpointInfo* ep) {
+    return (uint16)(((uint32*)ep->pma-(uint32*)USB_PMA_BASE) * 2);
+}
+
 void usb_generic_set_info(uint16 idVendor, uint16 idProduct, const char* iManufacturer, const char* iProduct, const char* iSerialNumber) {
     if (idVendor != 0)
         usbGenericDescriptor_Device.idVendor = idVendor;
@@ -415,10 +512,6 @@ static void usbInit(void) {
 
 #define BTABLE_ADDRESS 0x00
 
-static inline uint16 pma_ptr_to_offset(uint32* p) {
-    return (uint16)(((uint32*)p-(uint32*)USB_PMA_BASE) * 2);
-}
-
 static void usbReset(void) {
     pInformation->Current_Configuration = 0;
 
@@ -451,15 +544,18 @@ static void usbReset(void) {
             uint8 address = e->address;
             usb_set_ep_type(address, epTypes[e->type]);
             usb_set_ep_kind(address, e->doubleBuffer ? USB_EP_EP_KIND_DBL_BUF : 0);
-            uint16 pmaOffset = pma_ptr_to_offset(e->pma);
+            uint16 pmaOffset = usb_generic_pma_offset(e);
+            uint16 bufSize = PMA_DBL_BUF_SIZE(e);
+            e->txStaged = -1;
+            e->rxHeld = 0;
             if (e->tx) {
                 usb_set_ep_tx_addr(address, pmaOffset);
                 usb_set_ep_tx_stat(address, USB_EP_STAT_TX_NAK);
                 if (e->doubleBuffer) {
                     usb_set_ep_tx_buf0_addr(address, pmaOffset);
-                    usb_set_ep_tx_buf1_addr(address, pmaOffset+e->pmaSize/2);
-                    usb_set_ep_tx_buf0_count(address, e->pmaSize/2);
-                    usb_set_ep_tx_buf1_count(address, e->pmaSize/2);
+                    usb_set_ep_tx_buf1_addr(address, pmaOffset+bufSize);
+                    usb_set_ep_tx_buf0_count(address, e->canDoubleBuffer ? 0 : bufSize);
+                    usb_set_ep_tx_buf1_count(address, e->canDoubleBuffer ? 0 : bufSize);
                 }
             }
             else {
@@ -467,6 +563,17 @@ static void usbReset(void) {
 				if (! e->doubleBuffer) {
 					usb_set_ep_rx_count(address, e->pmaSize);
 				}
+				else {
+                    usb_set_ep_rx_buf0_addr(address, pmaOffset);
+                    usb_set_ep_rx_buf1_addr(address, pmaOffset+bufSize);
+                    usb_set_ep_rx_buf0_count(address, bufSize);
+                    usb_set_ep_rx_buf1_count(address, bufSize);
+                    /* bulk: the peripheral starts on buffer 0, and SW_BUF
+                     * is set so that it can go ahead; isochronous endpoints
+                     * just alternate with DTOG_RX */
+                    if (e->canDoubleBuffer)
+                        usb_set_ep_rx_sw_buf(address);
+				}
 				usb_set_ep_rx_stat(address, USB_EP_STAT_RX_VALID);
             }
         }
@@ -748,58 +855,219 @@ static RESULT usbGetInterfaceSetting(uint8 interface, uint8 alt_setting) {
     return USB_SUCCESS;
 }
 
+/* The packet memory is 16 bits wide but sits at every other halfword
+ * of the CPU's address space, so each 32-bit word at dst/src holds two
+ * bytes of packet data in its low half. The copies below move one
+ * halfword per PMA access and, when the RAM buffer is word aligned,
+ * one word per two PMA accesses, four at a time. Any alignment works. */
+
 void usb_copy_to_pma_ptr(volatile const uint8 *buf, uint16 len, uint32* dst) {
+    const uint8 *b = (const uint8*)buf;
+    volatile uint16 *d = (volatile uint16*)dst;
     uint16 n = len >> 1;
-    uint16 i;
-    for (i = 0; i < n; i++) {
-        *(uint16*)dst = (uint16)(*buf) | *(buf + 1) << 8;
-        buf += 2;
-        dst++;
+
+    if (((uint32)b & 3) == 0) {
+        const uint32 *w = (const uint32*)b;
+        for (; n >= 8; n -= 8) {
+            uint32 w0 = w[0], w1 = w[1], w2 = w[2], w3 = w[3];
+            d[0] = w0;  d[2] = w0 >> 16;
+            d[4] = w1;  d[6] = w1 >> 16;
+            d[8] = w2;  d[10] = w2 >> 16;
+            d[12] = w3; d[14] = w3 >> 16;
+            w += 4;
+            d += 16;
+        }
+        b = (const uint8*)w;
+    }
+    if (((uint32)b & 1) == 0) {
+        const uint16 *h = (const uint16*)b;
+        for (; n >= 4; n -= 4) {
+            d[0] = h[0];
+            d[2] = h[1];
+            d[4] = h[2];
+            d[6] = h[3];
+            h += 4;
+            d += 8;
+        }
+        for (; n; n--) {
+            *d = *h++;
+            d += 2;
+        }
+        b = (const uint8*)h;
+    } else {
+        for (; n; n--) {
+            *d = b[0] | (b[1] << 8);
+            b += 2;
+            d += 2;
+        }
     }
     if (len & 1) {
-        *dst = *buf;
+        *d = *b;
     }
 }
 
 void usb_copy_from_pma_ptr(volatile uint8 *buf, uint16 len, uint32* src) {
-    uint16 *dst = (uint16*)buf;
+    uint8 *b = (uint8*)buf;
+    volatile const uint16 *s = (volatile const uint16*)src;
     uint16 n = len >> 1;
-    uint16 i;
-    for (i = 0; i < n; i++) {
-        *dst++ = *src++;
+
+    if (((uint32)b & 3) == 0) {
+        uint32 *w = (uint32*)b;
+        for (; n >= 8; n -= 8) {
+            w[0] = s[0] | ((uint32)s[2] << 16);
+            w[1] = s[4] | ((uint32)s[6] << 16);
+            w[2] = s[8] | ((uint32)s[10] << 16);
+            w[3] = s[12] | ((uint32)s[14] << 16);
+            s += 16;
+            w += 4;
+        }
+        b = (uint8*)w;
+    }
+    if (((uint32)b & 1) == 0) {
+        uint16 *h = (uint16*)b;
+        for (; n >= 4; n -= 4) {
+            h[0] = s[0];
+            h[1] = s[2];
+            h[2] = s[4];
+            h[3] = s[6];
+            s += 8;
+            h += 4;
+        }
+        for (; n; n--) {
+            *h++ = *s;
+            s += 2;
+        }
+        b = (uint8*)h;
+    } else {
+        for (; n; n--) {
+            uint16 v = *s;
+            b[0] = (uint8)v;
+            b[1] = (uint8)(v >> 8);
+            s += 2;
+            b += 2;
+        }
     }
     if (len & 1) {
-        *dst = *src & 0xFF;
+        *b = (uint8)*s;
     }
 }
 
-// return bytes read
-uint32 usb_generic_read_to_circular_buffer(USBEndpointInfo* ep, volatile uint8* buf, uint32 circularBufferSize, volatile uint32* headP) {
+/* Copy len bytes from the circular buffer buf[circularBufferSize],
+ * starting at *tailP, and advance *tailP. The buffer is split into at
+ * most two linear runs, with the halfword straddling the wrap point
+ * (if any) put together by hand. */
+void usb_copy_to_pma_ptr_circular(volatile const uint8 *buf, uint32 circularBufferSize, volatile uint32* tailP, uint16 len, uint32* dst) {
+    uint32 tail = *tailP;
+    uint32 first = circularBufferSize - tail;
+
+    if (first >= len) {
+        usb_copy_to_pma_ptr(buf + tail, len, dst);
+        tail += len;
+        if (tail == circularBufferSize)
+            tail = 0;
+    }
+    else {
+        uint32 rest = len - first;
+        usb_copy_to_pma_ptr(buf + tail, first & ~1, dst);
+        dst += first >> 1;
+        if (first & 1) {
+            *(volatile uint16*)dst = buf[circularBufferSize - 1] | (buf[0] << 8);
+            usb_copy_to_pma_ptr(buf + 1, rest - 1, dst + 1);
+        }
+        else {
+            usb_copy_to_pma_ptr(buf, rest, dst);
+        }
+        tail = rest;
+    }
+
+    *tailP = tail;
+}
+
+/* Copy len bytes from packet memory into the circular buffer
+ * buf[circularBufferSize], starting at *headP, and advance *headP. */
+void usb_copy_from_pma_ptr_circular(volatile uint8 *buf, uint32 circularBufferSize, volatile uint32* headP, uint16 len, uint32* src) {
     uint32 head = *headP;
-    uint32 ep_rx_size = usb_get_ep_rx_count(ep->address);
-    /* This copy won't overwrite unread bytes as long as there is
-     * enough room in the USB Rx buffer for next packet */
-    volatile uint32 *src = ep->pma;
-
-    for (uint32 i = 0; i < ep_rx_size; i++) {
-        uint16 tmp = *src++;
-        buf[head] = (uint8)tmp;
-        head = (head + 1) % circularBufferSize;
-        i++;
-        if (i >= ep_rx_size) {
-            break;
+    uint32 first = circularBufferSize - head;
+
+    if (first >= len) {
+        usb_copy_from_pma_ptr(buf + head, len, src);
+        head += len;
+        if (head == circularBufferSize)
+            head = 0;
+    }
+    else {
+        uint32 rest = len - first;
+        usb_copy_from_pma_ptr(buf + head, first & ~1, src);
+        src += first >> 1;
+        if (first & 1) {
+            uint16 v = *(volatile uint16*)src;
+            buf[circularBufferSize - 1] = (uint8)v;
+            buf[0] = (uint8)(v >> 8);
+            usb_copy_from_pma_ptr(buf + 1, rest - 1, src + 1);
+        }
+        else {
+            usb_copy_from_pma_ptr(buf, rest, src);
         }
-        buf[head] = (uint8)(tmp>>8);
-        head = (head + 1) % circularBufferSize;
+        head = rest;
     }
 
     *headP = head;
-    
+}
+
+static inline uint8 is_double_buffered_bulk(USBEndpointInfo* ep) {
+    return ep->doubleBuffer && ep->canDoubleBuffer;
+}
+
+// return bytes read; with tailP NULL a double-buffered endpoint's packet
+// buffer is always held until usb_generic_enable_rx()
+static uint32 read_to_circular_buffer(USBEndpointInfo* ep, volatile uint8* buf, uint32 circularBufferSize, volatile uint32* headP, const uint32* tailP) {
+    if (ep->doubleBuffer && ep->type == USB_GENERIC_ENDPOINT_TYPE_ISO) {
+        // DTOG_RX has already moved on, so the packet is in the other buffer
+        uint32 dtog = usb_get_ep_dtog_rx(ep->address);
+        uint32 ep_rx_size = dtog ? usb_get_ep_rx_buf0_count(ep->address) : usb_get_ep_rx_buf1_count(ep->address);
+        usb_copy_from_pma_ptr_circular(buf, circularBufferSize, headP, ep_rx_size, dtog ? PMA_PTR_BUF0(ep) : PMA_PTR_BUF1(ep));
+        return ep_rx_size;
+    }
+
+    if (! is_double_buffered_bulk(ep)) {
+        uint32 ep_rx_size = usb_get_ep_rx_count(ep->address);
+        /* This copy won't overwrite unread bytes as long as there is
+         * enough room in the USB Rx buffer for next packet */
+        usb_copy_from_pma_ptr_circular(buf, circularBufferSize, headP, ep_rx_size, ep->pma);
+        return ep_rx_size;
+    }
+
+    // the packet is in the buffer the peripheral just left, the one SW_BUF doesn't point at
+    uint32 sw_buf = usb_get_ep_rx_sw_buf(ep->address);
+    uint32 ep_rx_size = sw_buf ? usb_get_ep_rx_buf0_count(ep->address) : usb_get_ep_rx_buf1_count(ep->address);
+    uint32* src = sw_buf ? PMA_PTR_BUF0(ep) : PMA_PTR_BUF1(ep);
+
+    ep->rxHeld = 1;
+    if (tailP != NULL) {
+        int32 unread = (int32)(*headP - *tailP) % (int32)circularBufferSize;
+        if (unread < 0)
+            unread += circularBufferSize;
+        if (unread + ep_rx_size + PMA_DBL_BUF_SIZE(ep) < circularBufferSize)
+            usb_generic_enable_rx(ep);
+    }
+    usb_copy_from_pma_ptr_circular(buf, circularBufferSize, headP, ep_rx_size, src);
     return ep_rx_size;
 }
 
+// return bytes read
+uint32 usb_generic_read_to_circular_buffer(USBEndpointInfo* ep, volatile uint8* buf, uint32 circularBufferSize, volatile uint32* headP) {
+    return read_to_circular_buffer(ep, buf, circularBufferSize, headP, NULL);
+}
+
+// Like usb_generic_read_to_circular_buffer(), but given the reader's tail, a
+// double-buffered endpoint gets its other packet buffer back before the copy
+// if there will still be room for a packet afterwards. Otherwise the buffer
+// stays held until usb_generic_enable_rx().
+uint32 usb_generic_read_to_circular_buffer_ahead(USBEndpointInfo* ep, volatile uint8* buf, uint32 circularBufferSize, volatile uint32* headP, uint32 tail) {
+    return read_to_circular_buffer(ep, buf, circularBufferSize, headP, &tail);
+}
+
 // returns number of bytes read
-// buf should be uint16-aligned
 uint32 usb_generic_read_to_buffer(USBEndpointInfo* ep, volatile uint8* buf, uint32 bufferSize) {
     uint32 ep_rx_size = usb_get_ep_rx_count(ep->address);
     if (ep_rx_size > bufferSize)
@@ -819,8 +1087,68 @@ uint32 usb_generic_send_from_buffer(USBEndpointInfo* ep, volatile uint8* buf, ui
     return amount;
 }
 
+// copy up to one packet from the circular buffer into the IN buffer the
+// peripheral isn't using; returns the amount staged
+static uint32 stage_tx_packet(USBEndpointInfo* ep, volatile uint8* buf, uint32 circularBufferSize, uint32 head, volatile uint32* tailP) {
+    int32 amount = (head - *tailP) % circularBufferSize;
+    if (amount < 0)
+        amount += circularBufferSize;
+    if (amount > PMA_DBL_BUF_SIZE(ep))
+        amount = PMA_DBL_BUF_SIZE(ep);
+
+    if (usb_get_ep_tx_sw_buf(ep->address)) {
+        usb_copy_to_pma_ptr_circular(buf, circularBufferSize, tailP, amount, PMA_PTR_BUF1(ep));
+        usb_set_ep_tx_buf1_count(ep->address, amount);
+    }
+    else {
+        usb_copy_to_pma_ptr_circular(buf, circularBufferSize, tailP, amount, PMA_PTR_BUF0(ep));
+        usb_set_ep_tx_buf0_count(ep->address, amount);
+    }
+    return amount;
+}
+
+// Double-buffered version of usb_generic_send_from_circular_buffer(): the
+// packet after the one being released is copied into the other buffer
+// while the first is on the bus, so the next callback only has to flip it.
+static uint32 send_from_circular_buffer_staged(USBEndpointInfo* ep, volatile uint8* buf, uint32 circularBufferSize, uint32 head, volatile uint32* tailP, volatile int8* transmittingP) {
+    int32 amount = ep->txStaged;
+    ep->txStaged = -1;
+    if (amount < 0)
+        amount = stage_tx_packet(ep, buf, circularBufferSize, head, tailP);
+
+    if (amount == 0) {
+        if (*transmittingP <= 0) {
+            *transmittingP = -1;
+            return 0; // it was already flushed, keep Tx endpoint disabled
+        }
+        *transmittingP = 0;
+        // zero-length packet to flush
+        if (usb_get_ep_tx_sw_buf(ep->address))
+            usb_set_ep_tx_buf1_count(ep->address, 0);
+        else
+            usb_set_ep_tx_buf0_count(ep->address, 0);
+    }
+    else {
+        *transmittingP = 1;
+    }
+
+    usb_toggle_ep_tx_sw_buf(ep->address);
+    usb_generic_enable_tx(ep);
+
+    if (amount > 0) {
+        uint32 next = stage_tx_packet(ep, buf, circularBufferSize, head, tailP);
+        if (next > 0)
+            ep->txStaged = next;
+    }
+
+    return amount;
+}
+
 // transmitting = 1 when transmitting, 0 when done but not flushed, negative when done and flushed
 uint32 usb_generic_send_from_circular_buffer(USBEndpointInfo* ep, volatile uint8* buf, uint32 circularBufferSize, uint32 head, volatile uint32* tailP, volatile int8* transmittingP) {
+    if (is_double_buffered_bulk(ep))
+        return send_from_circular_buffer_staged(ep, buf, circularBufferSize, head, tailP, transmittingP);
+
     uint32 tail = *tailP;
 	int32 amount = (head - tail) % circularBufferSize;
     if (amount < 0) {
@@ -844,21 +1172,7 @@ uint32 usb_generic_send_from_circular_buffer(USBEndpointInfo* ep, volatile uint8
     }
     
 	// copy the bytes from USB Tx buffer to PMA buffer
-	uint32 *dst = ep->pma;
-
-    for (int32 i = 0; i < amount; i++) {
-        uint16 low = buf[tail];
-        tail = (tail + 1) % circularBufferSize;
-        i++;
-        if (i >= amount) {
-            *dst = low;
-            break;
-        }
-        *dst++ = ((uint16)buf[tail] << 8) | low;
-        tail = (tail + 1) % circularBufferSize;
-    }
-
-    *tailP = tail; /* store volatile variable */
+    usb_copy_to_pma_ptr_circular(buf, circularBufferSize, tailP, amount, ep->pma);
     
 flush:
 	// enable Tx endpoint
@@ -870,8 +1184,6 @@ flush:
 
 
 uint32 usb_generic_send_from_circular_buffer_double_buffered(USBEndpointInfo* ep, volatile uint8* buf, uint32 circularBufferSize, uint32 amount, volatile uint32* tailP) {
-    uint32 tail = *tailP; /* load volatile variable */
-
     uint32 dtog_tx = usb_get_ep_dtog_tx(ep->address);
 
     /* copy the bytes from USB Tx buffer to PMA buffer */
@@ -884,19 +1196,7 @@ uint32 usb_generic_send_from_circular_buffer_double_buffered(USBEndpointInfo* ep
     if (amount > ep->pmaSize / 2)
         amount = ep->pmaSize / 2;
 
-    for (uint32 i = 0; i < amount; i++) {
-        uint16 low = buf[tail];
-        tail = (tail + 1) % circularBufferSize;
-        i++;
-        if (i >= amount) {
-            *dst = low;
-            break;
-        }
-        *dst++ = ((uint16)buf[tail] << 8) | low;
-        tail = (tail + 1) % circularBufferSize;
-    }
-
-    *tailP = tail; /* store volatile variable */
+    usb_copy_to_pma_ptr_circular(buf, circularBufferSize, tailP, amount, dst);
 
     if (dtog_tx)
         usb_set_ep_tx_buf1_count(ep->address, amount);
@@ -44,6 +44,9 @@ typedef struct USBEndpointInfo {
     uint8 tx:1; // 1 if TX, 0 if RX
     uint8 exclusive:1; // 1 if cannot use the same endpoint number for both rx and tx
     uint8 align:1; // 1 if next endpoint of the opposite type shares the same endpoint number as this
+    uint8 canDoubleBuffer:1; // 1 if usb_generic_set_parts() may double-buffer this bulk endpoint when the PMA has room
+    volatile int16 txStaged; // double-buffered bulk TX: length of the packet waiting in the spare buffer, or -1
+    volatile uint8 rxHeld; // double-buffered bulk RX: 1 while both packet buffers are waiting for the application
 } USBEndpointInfo;
 
 typedef struct USBCompositePart {
@@ -71,6 +74,11 @@ struct usb_chunk {
 uint32 usb_generic_chunks_length(struct usb_chunk* chunk);
 
 static inline void usb_generic_enable_rx(USBEndpointInfo* ep) {
+    if (ep->doubleBuffer && ep->canDoubleBuffer && ep->rxHeld) {
+        /* hand the packet buffer we've emptied back to the peripheral */
+        ep->rxHeld = 0;
+        usb_toggle_ep_rx_sw_buf(ep->address);
+    }
     usb_set_ep_rx_stat(ep->address, USB_EP_STAT_RX_VALID);
 }
 
@@ -124,7 +132,10 @@ static inline void usb_generic_set_tx(USBEndpointInfo* ep, uint32 length) {
 }
 
 // for double buffering
-#define PMA_PTR_BUF1(ep) ((void*)((uint8*)(ep)->pma+(ep)->pmaSize))
+// pmaSize covers both buffers of a part's own double-buffered endpoints, but
+// only one buffer of those that usb_generic_set_parts() chose to double-buffer
+#define PMA_DBL_BUF_SIZE(ep) ((ep)->canDoubleBuffer ? (ep)->pmaSize : (ep)->pmaSize / 2)
+#define PMA_PTR_BUF1(ep) ((void*)((uint8*)(ep)->pma+2*PMA_DBL_BUF_SIZE(ep)))
 #define PMA_PTR_BUF0(ep) ((ep)->pma)
 
 uint32 usb_generic_send_from_circular_buffer_double_buffered(USBEndpointInfo* ep, volatile uint8* buf, uint32 circularBufferSize, uint32 amount, volatile uint32* tailP);
@@ -139,12 +150,17 @@ void usb_generic_disable(void);
 void usb_generic_enable(void);
 void usb_copy_from_pma_ptr(volatile uint8 *buf, uint16 len, uint32* pma);
 void usb_copy_to_pma_ptr(volatile const uint8 *buf, uint16 len, uint32* pma);
+void usb_copy_from_pma_ptr_circular(volatile uint8 *buf, uint32 circularBufferSize, volatile uint32* headP, uint16 len, uint32* pma);
+void usb_copy_to_pma_ptr_circular(volatile const uint8 *buf, uint32 circularBufferSize, volatile uint32* tailP, uint16 len, uint32* pma);
 uint32 usb_generic_read_to_circular_buffer(USBEndpointInfo* ep, volatile uint8* buf, uint32 bufferSize, volatile uint32* headP);
+uint32 usb_generic_read_to_circular_buffer_ahead(USBEndpointInfo* ep, volatile uint8* buf, uint32 bufferSize, volatile uint32* headP, uint32 tail);
 #define USB_GENERIC_UNLIMITED_BUFFER 0xFFFFFFFFul
 uint32 usb_generic_read_to_buffer(USBEndpointInfo* ep, volatile uint8* buf, uint32 bufferSize);
 uint32 usb_generic_send_from_circular_buffer(USBEndpointInfo* ep, volatile uint8* buf, uint32 bufferSize, uint32 head, volatile uint32* tailP, volatile int8* transmittingP);
 uint32 usb_generic_send_from_buffer(USBEndpointInfo* ep, volatile uint8* buf, uint32 amount);
 uint16_t usb_generic_roundUpToPowerOf2(uint16_t x);
+uint16 usb_generic_pma_offset(USBEndpointInfo* ep);
+uint16 usb_generic_pma_used(void);
 
 #ifdef __cplusplus
 }
@@ -229,7 +229,6 @@ void usb_hid_setDedicatedRXEndpoint(void* buffer, uint16_t size, USBHIDOutputEnd
 }
 
 
-#define HID_TX_BUFFER_SIZE	256 // must be power of 2
 #define HID_TX_BUFFER_SIZE_MASK (HID_TX_BUFFER_SIZE-1)
 // Tx data
 static volatile uint8 hidBufferTx[HID_TX_BUFFER_SIZE];
@@ -237,6 +236,10 @@ static volatile uint8 hidBufferTx[HID_TX_BUFFER_SIZE];
 static volatile uint32 hid_tx_head = 0;
 // Read index from hidBufferTx
 static volatile uint32 hid_tx_tail = 0;
+// Count of bytes ever queued; hid_tx_head is this modulo HID_TX_BUFFER_SIZE
+static volatile uint32 hid_tx_total = 0;
+// One bit per byte of hidBufferTx, set on the last byte of each report
+static volatile uint32 hid_tx_report_end[HID_TX_BUFFER_SIZE/32];
 
 void usb_hid_set_report_descriptor(struct usb_chunk* chunks) {
     reportDescriptorChunks = chunks;
@@ -361,38 +364,105 @@ void usb_hid_set_buffers(uint8 type, volatile HIDBuffer_t* bufs, int n) {
     }
 }
 
+// Append one report to the Tx buffer and start sending if the endpoint
+// is idle. Call with the USB interrupt disabled.
+static void hid_tx_append(const uint8* buf, uint32 len)
+{
+	uint32 head = hid_tx_head; // load volatile variable
+	uint32 last = head;
+	uint16 i;
+
+	// copy data from user buffer to USB Tx buffer
+	for (i=0; i<len; i++) {
+		hidBufferTx[head] = buf[i];
+		hid_tx_report_end[head>>5] &= ~(1ul << (head & 31));
+		last = head;
+		head = (head+1) & HID_TX_BUFFER_SIZE_MASK;
+	}
+	hid_tx_report_end[last>>5] |= 1ul << (last & 31);
+	hid_tx_head = head; // store volatile variable
+	hid_tx_total += len;
+
+	if (transmitting<0) {
+		hidDataTxCb(); // initiate data transmission
+	}
+}
+
 /* This function is non-blocking.
  *
  * It copies data from a user buffer into the USB peripheral TX
- * buffer, and returns the number of bytes copied. */
+ * buffer, and returns the number of bytes copied. The bytes copied by
+ * one call are sent as one report, in packets of their own. */
 uint32 usb_hid_tx(const uint8* buf, uint32 len)
 {
 	if (len==0) return 0; // no data to send
 
-	uint32 head = hid_tx_head; // load volatile variable
-	uint32 tx_unsent = (head - hid_tx_tail) & HID_TX_BUFFER_SIZE_MASK;
+	usb_generic_disable_interrupts_ep0();
+
+	uint32 tx_unsent = (hid_tx_head - hid_tx_tail) & HID_TX_BUFFER_SIZE_MASK;
 
     // We can only put bytes in the buffer if there is place
     if (len > (HID_TX_BUFFER_SIZE-tx_unsent-1) ) {
         len = (HID_TX_BUFFER_SIZE-tx_unsent-1);
     }
-	if (len==0) return 0; // buffer full
+	if (len>0)
+		hid_tx_append(buf, len);
 
-	uint16 i;
-	// copy data from user buffer to USB Tx buffer
-	for (i=0; i<len; i++) {
-		hidBufferTx[head] = buf[i];
-		head = (head+1) & HID_TX_BUFFER_SIZE_MASK;
+	usb_generic_enable_interrupts_ep0();
+
+    return len;
+}
+
+/* This function is non-blocking.
+ *
+ * Queues a whole report for a reporter that only cares about its
+ * latest state, given where its previous report went. With
+ * HID_TX_SKIP_UNCHANGED, a report equal to the previous one, which is
+ * still in the buffer, isn't queued again. With HID_TX_LATEST_ONLY, if
+ * the previous report is still waiting for the host to poll, it's
+ * overwritten in place. With neither, the report is just queued whole.
+ * Returns len if the report was dealt with, or 0 if it has to be
+ * retried because the buffer is full. */
+uint32 usb_hid_tx_latest(const uint8* buf, uint32 len, uint8 mode, HIDTxSlot_t* slot)
+{
+	if (len==0 || len>=HID_TX_BUFFER_SIZE) return 0;
+
+	usb_generic_disable_interrupts_ep0();
+
+	uint32 tx_unsent = (hid_tx_head - hid_tx_tail) & HID_TX_BUFFER_SIZE_MASK;
+	uint32 age = hid_tx_total - slot->position; // bytes queued since it
+	uint32 start = slot->position & HID_TX_BUFFER_SIZE_MASK;
+	uint32 i;
+
+	// the bytes are still there until the buffer wraps around onto them
+	if (slot->queued && age <= HID_TX_BUFFER_SIZE) {
+		if (mode & HID_TX_SKIP_UNCHANGED) {
+			for (i=0; i<len && hidBufferTx[(start+i) & HID_TX_BUFFER_SIZE_MASK] == buf[i]; i++) ;
+			if (i==len) {
+				usb_generic_enable_interrupts_ep0();
+				return len;
+			}
+		}
+		// and the endpoint hasn't taken any of them yet
+		if ((mode & HID_TX_LATEST_ONLY) && age <= tx_unsent) {
+			for (i=0; i<len; i++)
+				hidBufferTx[(start+i) & HID_TX_BUFFER_SIZE_MASK] = buf[i];
+			usb_generic_enable_interrupts_ep0();
+			return len;
+		}
 	}
-	hid_tx_head = head; // store volatile variable
 
-	while(transmitting >= 0);
-	
-	if (transmitting<0) {
-		hidDataTxCb(); // initiate data transmission
+	if (len > HID_TX_BUFFER_SIZE-tx_unsent-1) {
+		usb_generic_enable_interrupts_ep0();
+		return 0; // buffer full
 	}
+	slot->position = hid_tx_total;
+	slot->queued = 1;
+	hid_tx_append(buf, len);
 
-    return len;
+	usb_generic_enable_interrupts_ep0();
+
+	return len;
 }
 
 
@@ -404,8 +474,21 @@ uint32 usb_hid_get_pending(void) {
 
 static void hidDataTxCb(void)
 {
+    uint32 head = hid_tx_head;
+    uint32 end = hid_tx_tail;
+    uint32 n;
+
+    // hosts take one report per transfer, so stop the packet at the end
+    // of the report at the tail rather than sending the next one with it
+    for (n=0; end != head && n < txEPSize; n++) {
+        uint32 i = end;
+        end = (end+1) & HID_TX_BUFFER_SIZE_MASK;
+        if (hid_tx_report_end[i>>5] & (1ul << (i & 31)))
+            break;
+    }
+
     usb_generic_send_from_circular_buffer(USB_HID_TX_ENDPOINT_INFO, 
-        hidBufferTx, HID_TX_BUFFER_SIZE, hid_tx_head, &hid_tx_tail, &transmitting);
+        hidBufferTx, HID_TX_BUFFER_SIZE, end, &hid_tx_tail, &transmitting);
 }
 
 static void hidDataRxCb(void)
@@ -427,9 +510,11 @@ static void hidDataRxCb(void)
 
 
 static void hidUSBReset(void) {
-    /* Reset the RX/TX state */
-	hid_tx_head = 0;
-	hid_tx_tail = 0;
+    /* Reset the RX/TX state; moving the total on a whole buffer
+     * makes usb_hid_tx_latest() forget what it queued before */
+	hid_tx_total += HID_TX_BUFFER_SIZE;
+	hid_tx_head = hid_tx_total & HID_TX_BUFFER_SIZE_MASK;
+	hid_tx_tail = hid_tx_head;
     transmitting = -1;
 }
 
@@ -49,6 +49,18 @@
 #define HID_BUFFER_UNREAD   USB_CONTROL_DONE
 #define HID_BUFFER_READ     2
 
+#define HID_TX_BUFFER_SIZE	256 // must be power of 2
+
+/* usb_hid_tx_latest() modes */
+#define HID_TX_SKIP_UNCHANGED 1 // don't queue a report identical to the last one
+#define HID_TX_LATEST_ONLY    2 // replace the last report if it hasn't gone out yet
+
+/* Where a reporter's last report went, for usb_hid_tx_latest() */
+typedef struct {
+    uint32 position; // count of bytes queued before it
+    uint8 queued;    // 0 until a report has been queued
+} HIDTxSlot_t;
+
 extern USBCompositePart usbHIDPart;
 
 typedef void (*USBHIDOutputEndpointReceiver)(void* extra, volatile void* buffer, uint16_t size);
@@ -139,6 +151,7 @@ typedef struct
  */
 
 uint32 usb_hid_tx(const uint8* buf, uint32 len);
+uint32 usb_hid_tx_latest(const uint8* buf, uint32 len, uint8 mode, HIDTxSlot_t* slot);
 uint32 usb_hid_tx_mod(const uint8* buf, uint32 len);
 uint32 usb_hid_data_available(void); /* in RX buffer */
 
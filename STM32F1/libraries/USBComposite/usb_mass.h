@@ -25,6 +25,16 @@ extern "C" {
 # error MAX_BULK_PACKET_SIZE must divide 512
 #endif
 
+// Sectors buffered per media access. READ(10) and WRITE(10) move up to this
+// many sectors in one call to the drive's reader or writer; each one costs
+// 512 bytes of RAM.
+#ifndef SCSI_BUFFER_SECTORS
+#define SCSI_BUFFER_SECTORS        4
+#endif
+#if SCSI_BUFFER_SECTORS < 1
+# error SCSI_BUFFER_SECTORS must be at least 1
+#endif
+
 
   /* MASS Storage Requests */
 #define REQUEST_GET_MAX_LUN                0xFE
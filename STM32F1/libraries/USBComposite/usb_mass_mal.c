@@ -40,3 +40,34 @@ uint16_t usb_mass_mal_write_memory(uint8_t lun, uint8_t *writebuff, uint32_t sta
 	else
 		return USB_MASS_MAL_SUCCESS;
 }
+
+/* Drives without split-phase support do the whole transfer in the start call,
+ * and finishing is then a no-op. */
+uint16_t usb_mass_mal_read_start(uint8_t lun, uint8_t *readbuff, uint32_t startSector, uint16_t numSectors) {
+	if (lun < USB_MASS_MAX_DRIVES && usb_mass_drives[lun].readStart == NULL)
+		return usb_mass_mal_read_memory(lun, readbuff, startSector, numSectors);
+	if (lun >= USB_MASS_MAX_DRIVES || ! usb_mass_drives[lun].readStart(readbuff, startSector, numSectors))
+		return USB_MASS_MAL_FAIL;
+	else
+		return USB_MASS_MAL_SUCCESS;
+}
+
+uint16_t usb_mass_mal_write_start(uint8_t lun, uint8_t *writebuff, uint32_t startSector, uint16_t numSectors) {
+	if (lun < USB_MASS_MAX_DRIVES && usb_mass_drives[lun].writeStart == NULL)
+		return usb_mass_mal_write_memory(lun, writebuff, startSector, numSectors);
+	if (lun >= USB_MASS_MAX_DRIVES || ! usb_mass_drives[lun].writeStart(writebuff, startSector, numSectors))
+		return USB_MASS_MAL_FAIL;
+	else
+		return USB_MASS_MAL_SUCCESS;
+}
+
+uint16_t usb_mass_mal_finish(uint8_t lun) {
+	if (lun >= USB_MASS_MAX_DRIVES || (usb_mass_drives[lun].finish != NULL && ! usb_mass_drives[lun].finish()))
+		return USB_MASS_MAL_FAIL;
+	else
+		return USB_MASS_MAL_SUCCESS;
+}
+
+bool usb_mass_mal_is_split_phase(uint8_t lun) {
+	return lun < USB_MASS_MAX_DRIVES && usb_mass_drives[lun].finish != NULL;
+}
@@ -17,6 +17,7 @@ typedef bool (*MassStorageReader)(uint8_t *readbuff, uint32_t startSector, uint1
 typedef bool (*MassStorageStatuser)(void);
 typedef bool (*MassStorageInitializer)(void);
 typedef bool (*MassStorageFormatter)(void);
+typedef bool (*MassStorageFinisher)(void);
 
 typedef struct {
     uint32_t blockCount;
@@ -25,6 +26,12 @@ typedef struct {
 	MassStorageStatuser status;
 	MassStorageInitializer init;
 	MassStorageFormatter format;
+	/* Optional split-phase access: readStart/writeStart begin a transfer and
+	 * return, finish waits for it and reports whether it worked. A drive with
+	 * a finisher gets its media access overlapped with USB traffic. */
+	MassStorageReader readStart;
+	MassStorageWriter writeStart;
+	MassStorageFinisher finish;
 } MassStorageDriveInfo;
 
 extern MassStorageDriveInfo usb_mass_drives[USB_MASS_MAX_DRIVES];
@@ -33,6 +40,10 @@ uint16_t usb_mass_mal_get_status(uint8_t lun);
 uint16_t usb_mass_mal_read_memory(uint8_t lun, uint8_t *readbuff, uint32_t startSector, uint16_t numSectors);
 uint16_t usb_mass_mal_write_memory(uint8_t lun, uint8_t *writebuff, uint32_t startSector, uint16_t numSectors);
 void usb_mass_mal_format(uint8_t lun);
+uint16_t usb_mass_mal_read_start(uint8_t lun, uint8_t *readbuff, uint32_t startSector, uint16_t numSectors);
+uint16_t usb_mass_mal_write_start(uint8_t lun, uint8_t *writebuff, uint32_t startSector, uint16_t numSectors);
+uint16_t usb_mass_mal_finish(uint8_t lun);
+bool usb_mass_mal_is_split_phase(uint8_t lun);
 
 #ifdef __cplusplus
 }
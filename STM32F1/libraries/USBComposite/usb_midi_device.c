@@ -43,6 +43,7 @@
 
 #include <libmaple/usb.h>
 #include <libmaple/delay.h>
+#include <libmaple/systick.h>
 
 /* Private headers */
 #include "usb_lib_globals.h"
@@ -241,12 +242,22 @@ static volatile uint32 midiBufferRx[64/4];
 static volatile uint32 rx_offset = 0;
 /* Transmit data */
 static volatile uint32 midiBufferTx[64/4];
-/* Write index into midiBufferTx */
-static volatile uint32 tx_offset = 0;
-/* Number of bytes left to transmit */
+/* Number of packets in the IN packet being sent */
 static volatile uint32 n_unsent_packets = 0;
 /* Are we currently sending an IN packet? */
 static volatile uint8 transmitting = 0;
+/* Was the last IN packet full size? Then a short one has to end the transfer */
+static volatile uint8 tx_last_full = 0;
+/* Queued events */
+static volatile uint32 midiQueueTx[USB_MIDI_TX_QUEUE_SIZE];
+/* Count of events queued, free running */
+static volatile uint32 tx_queue_head = 0;
+/* Count of events moved to midiBufferTx, free running */
+static volatile uint32 tx_queue_tail = 0;
+/* When the oldest event still in the queue (or one older) was queued */
+static volatile uint32 tx_queue_since = 0;
+/* How long a part-filled packet may wait for more events, in ms */
+static uint32 tx_latency = 0;
 /* Number of unread bytes */
 static volatile uint32 n_unread_packets = 0;
 
@@ -323,39 +334,99 @@ void usb_midi_setRXEPSize(uint32_t size) {
  * MIDI interface
  */
 
-/* This function is non-blocking.
- *
- * It copies data from a usercode buffer into the USB peripheral TX
- * buffer, and returns the number of bytes copied. */
-uint32 usb_midi_tx(const uint32* buf, uint32 packets) {
-    uint32 bytes=packets*4;
-    /* Last transmission hasn't finished, so abort. */
-    if (usb_midi_is_transmitting()) {
-		/* Copy to TxBuffer */
-		
-        return 0;  /* return len */
-    }
+/* Moves up to max queued events into the IN endpoint and sends them.
+ * Call only while not transmitting, with the USB interrupt masked or
+ * from it. max = 0 sends a zero-length packet. */
+static void midi_send_queued(uint32 max) {
+    uint32 packets = tx_queue_head - tx_queue_tail;
+    uint32 i;
 
-    /* We can only put usb_midi_txEPSize bytes in the buffer. */
-    if (bytes > usb_midi_txEPSize) {
-        bytes = usb_midi_txEPSize;
-        packets=bytes/4;
-    }
+    if (packets > max)
+        packets = max;
+    if (packets > usb_midi_txEPSize / 4)
+        packets = usb_midi_txEPSize / 4;
+
+    for (i = 0; i < packets; i++)
+        midiBufferTx[i] = midiQueueTx[(tx_queue_tail + i) & (USB_MIDI_TX_QUEUE_SIZE - 1)];
+    tx_queue_tail += packets;
 
-    /* Queue bytes for sending. */
     if (packets) {
-        usb_copy_to_pma_ptr((uint8 *)buf, bytes, USB_MIDI_TX_PMA_PTR);
+        usb_copy_to_pma_ptr((uint8 *)midiBufferTx, packets * 4, USB_MIDI_TX_PMA_PTR);
     }
     // We still need to wait for the interrupt, even if we're sending
     // zero bytes. (Sending zero-size packets is useful for flushing
     // host-side buffers.)
     n_unsent_packets = packets;
+    tx_last_full = (packets * 4 == usb_midi_txEPSize);
     transmitting = 1;
-    usb_generic_set_tx(USB_MIDI_TX_ENDPOINT_INFO, bytes);
+    usb_generic_set_tx(USB_MIDI_TX_ENDPOINT_INFO, packets * 4);
+}
+
+/* A full packet's worth always goes; less goes once the oldest event
+ * has waited tx_latency ms. */
+static uint8 midi_tx_due(void) {
+    uint32 queued = tx_queue_head - tx_queue_tail;
+
+    if (queued == 0)
+        return 0;
+    return queued >= usb_midi_txEPSize / 4 || systick_uptime() - tx_queue_since >= tx_latency;
+}
+
+/* This function is non-blocking.
+ *
+ * It copies event packets from a usercode buffer into the transmit
+ * queue, and returns the number of packets copied. If the IN endpoint
+ * is idle they are sent straight away, unless a latency has been set
+ * and there's less than a full USB packet; otherwise they go out with
+ * whatever else has been queued when the current packet completes. */
+uint32 usb_midi_tx(const uint32* buf, uint32 packets) {
+    uint32 head;
+    uint32 i;
+
+    usb_generic_disable_interrupts_ep0();
+
+    head = tx_queue_head;
+    if (packets > USB_MIDI_TX_QUEUE_SIZE - (head - tx_queue_tail))
+        packets = USB_MIDI_TX_QUEUE_SIZE - (head - tx_queue_tail);
+    if (packets && head == tx_queue_tail)
+        tx_queue_since = systick_uptime();
+
+    for (i = 0; i < packets; i++)
+        midiQueueTx[(head + i) & (USB_MIDI_TX_QUEUE_SIZE - 1)] = buf[i];
+    tx_queue_head = head + packets;
+
+    if (! transmitting && midi_tx_due())
+        midi_send_queued(USB_MIDI_TX_QUEUE_SIZE);
+
+    usb_generic_enable_interrupts_ep0();
 
     return packets;
 }
 
+/* Hold part-filled packets for up to ms milliseconds so that more
+ * events can share them. 0, the default, sends whenever the endpoint
+ * is idle. Held events go out from usb_midi_tx(),
+ * usb_midi_service_tx() or usb_midi_flush_tx(). */
+void usb_midi_set_tx_latency(uint32 ms) {
+    tx_latency = ms;
+}
+
+/* Send queued events whose time is up */
+void usb_midi_service_tx(void) {
+    usb_generic_disable_interrupts_ep0();
+    if (! transmitting && midi_tx_due())
+        midi_send_queued(USB_MIDI_TX_QUEUE_SIZE);
+    usb_generic_enable_interrupts_ep0();
+}
+
+/* Send queued events now, however few */
+void usb_midi_flush_tx(void) {
+    usb_generic_disable_interrupts_ep0();
+    if (! transmitting && tx_queue_head != tx_queue_tail)
+        midi_send_queued(USB_MIDI_TX_QUEUE_SIZE);
+    usb_generic_enable_interrupts_ep0();
+}
+
 uint32 usb_midi_data_available(void) {
     return n_unread_packets;
 }
@@ -364,8 +435,9 @@ uint8 usb_midi_is_transmitting(void) {
     return transmitting;
 }
 
+/* Events queued or in the packet being sent */
 uint16 usb_midi_get_pending(void) {
-    return n_unsent_packets;
+    return tx_queue_head - tx_queue_tail + n_unsent_packets;
 }
 
 /* Nonblocking byte receive.
@@ -413,6 +485,10 @@ uint32 usb_midi_peek(uint32* buf, uint32 packets) {
 static void midiDataTxCb(void) {
     n_unsent_packets = 0;
     transmitting = 0;
+    if (midi_tx_due())
+        midi_send_queued(USB_MIDI_TX_QUEUE_SIZE);
+    else if (tx_last_full)
+        midi_send_queued(0);
 }
 
 static void midiDataRxCb(void) {
@@ -440,6 +516,10 @@ static void usbMIDIReset(void) {
     n_unread_packets = 0;
     n_unsent_packets = 0;
     rx_offset = 0;
+    transmitting = 0;
+    tx_last_full = 0;
+    tx_queue_head = 0;
+    tx_queue_tail = 0;
 }
 
 
@@ -162,6 +162,18 @@ typedef struct {
  
 #define SYSEX_BUFFER_LENGTH 256
 
+/*
+ * Transmit queue, in event packets; must be a power of two. Events wait
+ * here while the IN endpoint is busy and go out up to a full USB packet
+ * (16 events) at a time.
+ */
+#ifndef USB_MIDI_TX_QUEUE_SIZE
+#define USB_MIDI_TX_QUEUE_SIZE 64
+#endif
+#if USB_MIDI_TX_QUEUE_SIZE & (USB_MIDI_TX_QUEUE_SIZE - 1)
+#error USB_MIDI_TX_QUEUE_SIZE must be a power of two
+#endif
+
     
  /*
  * MIDI interface
@@ -176,6 +188,9 @@ uint32 usb_midi_peek(uint32* buf, uint32 len);
 uint32 usb_midi_data_available(void); /* in RX buffer */
 uint16 usb_midi_get_pending(void);
 uint8 usb_midi_is_transmitting(void);
+void usb_midi_set_tx_latency(uint32 ms);
+void usb_midi_service_tx(void);
+void usb_midi_flush_tx(void);
 
 void sendThroughSysex(char *printbuffer, int bufferlength);
 
@@ -42,7 +42,17 @@ uint8_t SCSI_transferState = SCSI_TXFR_IDLE;
 uint32_t SCSI_blockReadCount = 0;
 uint32_t SCSI_blockOffset;
 uint32_t SCSI_counter = 0;
-uint8_t SCSI_dataBuffer[512]; /* 512 bytes (SDCard block size) */
+uint8_t SCSI_dataBuffer[SCSI_BUFFER_SECTORS * SCSI_BLOCK_SIZE] __attribute__((aligned(4))); /* whole SDCard blocks */
+
+/* For split-phase drives SCSI_dataBuffer is used as two halves, so the media
+ * fills or drains one while USB works on the other. */
+static uint8_t SCSI_pipelined;
+static uint32_t SCSI_bufferSectors;
+static uint8_t* SCSI_currentBuffer;
+static uint8_t* SCSI_pendingBuffer;
+static uint32_t SCSI_pendingSectors; /* media access in progress on SCSI_pendingBuffer */
+static uint32_t SCSI_nextSector; /* next sector to fetch from the media */
+static uint32_t SCSI_sectorsToFetch;
 
 uint8_t scsi_address_management(uint8_t lun, uint8_t cmd, uint32_t lba, uint32_t blockNbr);
 void scsi_read_memory(uint8_t lun, uint32_t memoryOffset, uint32_t transferLength);
@@ -255,84 +265,180 @@ uint8_t scsi_address_management(uint8_t lun, uint8_t cmd, uint32_t lba, uint32_t
   return (TRUE);
 }
 
+static void scsi_setup_buffers(uint8_t lun) {
+  if (SCSI_pendingSectors) {
+    /* left over from an aborted transfer */
+    usb_mass_mal_finish(lun);
+    SCSI_pendingSectors = 0;
+  }
+  SCSI_pipelined = SCSI_BUFFER_SECTORS >= 2 && usb_mass_mal_is_split_phase(lun);
+  SCSI_bufferSectors = SCSI_pipelined ? SCSI_BUFFER_SECTORS / 2 : SCSI_BUFFER_SECTORS;
+  SCSI_currentBuffer = SCSI_dataBuffer;
+}
+
+static uint8_t* scsi_other_buffer(void) {
+  if (!SCSI_pipelined)
+    return SCSI_dataBuffer;
+  else if (SCSI_currentBuffer == SCSI_dataBuffer)
+    return SCSI_dataBuffer + SCSI_bufferSectors * SCSI_BLOCK_SIZE;
+  else
+    return SCSI_dataBuffer;
+}
+
+/* Start fetching as many of the remaining sectors as fit in a buffer. */
+static uint16_t scsi_fetch_start(uint8_t lun, uint8_t* buf) {
+  uint32_t n = SCSI_sectorsToFetch < SCSI_bufferSectors ? SCSI_sectorsToFetch : SCSI_bufferSectors;
+
+  SCSI_pendingBuffer = buf;
+  SCSI_pendingSectors = n;
+  SCSI_nextSector += n;
+  SCSI_sectorsToFetch -= n;
+  return usb_mass_mal_read_start(lun, buf, SCSI_nextSector - n, n);
+}
+
+/* Make the sectors being fetched the ones being sent, and start on the
+ * following ones. The last packet of the old buffer is already in packet
+ * memory, so the media can work while it goes out. */
+static uint16_t scsi_fetch_next(uint8_t lun) {
+  uint16_t status = 0;
+
+  if (SCSI_pendingSectors == 0)
+    status = scsi_fetch_start(lun, SCSI_currentBuffer);
+  if (usb_mass_mal_finish(lun))
+    status = 1;
+  SCSI_currentBuffer = SCSI_pendingBuffer;
+  SCSI_blockReadCount = SCSI_pendingSectors * SCSI_BLOCK_SIZE;
+  SCSI_blockOffset = 0;
+  SCSI_pendingSectors = 0;
+
+  if (status == 0 && SCSI_pipelined && SCSI_sectorsToFetch != 0)
+    status = scsi_fetch_start(lun, scsi_other_buffer());
+  return status;
+}
+
+static void scsi_read_failed(uint8_t lun) {
+  if (SCSI_pendingSectors) {
+    usb_mass_mal_finish(lun);
+    SCSI_pendingSectors = 0;
+  }
+  SCSI_blockReadCount = 0;
+  SCSI_blockOffset = 0;
+  SCSI_transferState = SCSI_TXFR_IDLE;
+  scsi_set_sense_data(usb_mass_CBW.bLUN, SCSI_MEDIUM_ERROR, SCSI_UNRECOVERED_READ_ERROR);
+  usb_mass_bot_set_csw(BOT_CSW_CMD_FAILED, BOT_SEND_CSW_ENABLE);
+  usb_mass_bot_abort(BOT_DIR_IN);
+}
+
 void scsi_read_memory(uint8_t lun, uint32_t startSector, uint32_t numSectors) {
   static uint32_t length;
-  static uint64_t offset;
+  static uint8_t readError;
 
   if (SCSI_transferState == SCSI_TXFR_IDLE) {
-    offset = (uint64_t)startSector * SCSI_BLOCK_SIZE;
+    scsi_setup_buffers(lun);
     length = numSectors * SCSI_BLOCK_SIZE;
+    SCSI_nextSector = startSector;
+    SCSI_sectorsToFetch = numSectors;
     SCSI_transferState = SCSI_TXFR_ONGOING;
+    readError = scsi_fetch_next(lun);
   }
 
-  if (SCSI_transferState == SCSI_TXFR_ONGOING) {
-    if (SCSI_blockReadCount == 0) {
-      usb_mass_mal_read_memory(lun, SCSI_dataBuffer, (uint32_t)(offset/SCSI_BLOCK_SIZE), 1);
-
-      SCSI_blockReadCount = SCSI_BLOCK_SIZE - MAX_BULK_PACKET_SIZE;
-      SCSI_blockOffset = MAX_BULK_PACKET_SIZE;
-
-      usb_mass_sil_write(SCSI_dataBuffer, MAX_BULK_PACKET_SIZE);
-    } else {
-      usb_mass_sil_write(SCSI_dataBuffer + SCSI_blockOffset, MAX_BULK_PACKET_SIZE);
+  if (readError) {
+    /* only now is the IN endpoint free to take the CSW */
+    readError = 0;
+    scsi_read_failed(lun);
+    return;
+  }
 
-      SCSI_blockReadCount -= MAX_BULK_PACKET_SIZE;
-      SCSI_blockOffset += MAX_BULK_PACKET_SIZE;
-    }
+  if (SCSI_transferState == SCSI_TXFR_ONGOING) {
+    usb_mass_sil_write(SCSI_currentBuffer + SCSI_blockOffset, MAX_BULK_PACKET_SIZE);
 
-    offset += MAX_BULK_PACKET_SIZE;
+    SCSI_blockReadCount -= MAX_BULK_PACKET_SIZE;
+    SCSI_blockOffset += MAX_BULK_PACKET_SIZE;
     length -= MAX_BULK_PACKET_SIZE;
 
     usb_mass_CSW.dDataResidue -= MAX_BULK_PACKET_SIZE;
     usb_mass_CSW.bStatus = BOT_CSW_CMD_PASSED;
     // TODO: Led_RW_ON();
+
+    if (SCSI_blockReadCount == 0 && length != 0) {
+      readError = scsi_fetch_next(lun);
+    }
   }
 
   if (length == 0) {
     SCSI_blockReadCount = 0;
     SCSI_blockOffset = 0;
-    offset = 0;
     usb_mass_botState = BOT_STATE_DATA_IN_LAST;
     SCSI_transferState = SCSI_TXFR_IDLE;
     // TODO: Led_RW_OFF();
   }
 }
 
+/* Wait for the media to take the previous buffer; nonzero if it failed. */
+static uint16_t scsi_write_wait(uint8_t lun) {
+  if (SCSI_pendingSectors == 0)
+    return 0;
+  SCSI_pendingSectors = 0;
+  return usb_mass_mal_finish(lun);
+}
+
 void scsi_write_memory(uint8_t lun, uint32_t startSector, uint32_t numSectors) {
   static uint32_t length;
-  static uint64_t offset;
+  static uint32_t sector; /* first sector held in SCSI_currentBuffer */
+  static uint8_t writeError;
   uint32_t idx;
-  uint32_t temp = SCSI_counter + 64;
 
   if (SCSI_transferState == SCSI_TXFR_IDLE) {
-    offset = (uint64_t)startSector * SCSI_BLOCK_SIZE;
+    scsi_setup_buffers(lun);
     length = numSectors * SCSI_BLOCK_SIZE;
+    sector = startSector;
+    writeError = 0;
+    SCSI_counter = 0;
     SCSI_transferState = SCSI_TXFR_ONGOING;
   }
 
   if (SCSI_transferState == SCSI_TXFR_ONGOING) {
 
-    for (idx = 0; SCSI_counter < temp; SCSI_counter++) {
-      *((uint8_t *) SCSI_dataBuffer + SCSI_counter) = usb_mass_bulkDataBuff[idx++];
+    for (idx = 0; idx < usb_mass_dataLength && SCSI_counter < SCSI_bufferSectors * SCSI_BLOCK_SIZE; idx++) {
+      SCSI_currentBuffer[SCSI_counter++] = usb_mass_bulkDataBuff[idx];
     }
 
-    offset += usb_mass_dataLength;
     length -= usb_mass_dataLength;
+    usb_mass_CSW.dDataResidue -= usb_mass_dataLength;
 
-    if (!(length % SCSI_BLOCK_SIZE)) {
+    /* The packet has been copied out, so the host can send the next one
+     * while the media is programmed. */
+    usb_generic_enable_rx(USB_MASS_RX_ENDPOINT_INFO); /* enable the next transaction*/
+
+    if (SCSI_counter == SCSI_bufferSectors * SCSI_BLOCK_SIZE || length == 0) {
+      uint32_t n = SCSI_counter / SCSI_BLOCK_SIZE;
+      uint16_t status = scsi_write_wait(lun);
+
+      /* after a failure, take the rest of the data but don't write it */
+      if (!writeError && !status) {
+        status = usb_mass_mal_write_start(lun, SCSI_currentBuffer, sector, n);
+        if (!status)
+          SCSI_pendingSectors = n;
+      }
+      if (status && !writeError) {
+        writeError = 1;
+        scsi_set_sense_data(usb_mass_CBW.bLUN, SCSI_MEDIUM_ERROR, SCSI_WRITE_FAULT);
+      }
+      sector += n;
       SCSI_counter = 0;
-      usb_mass_mal_write_memory(lun, SCSI_dataBuffer, (uint32_t)(offset/SCSI_BLOCK_SIZE) - 1, 1);
+      SCSI_currentBuffer = scsi_other_buffer();
     }
 
-    usb_mass_CSW.dDataResidue -= usb_mass_dataLength;
-    usb_generic_enable_rx(USB_MASS_RX_ENDPOINT_INFO); /* enable the next transaction*/ // TODO
-
     // TODO: Led_RW_ON();
   }
 
   if ((length == 0) || (usb_mass_botState == BOT_STATE_CSW_Send)) {
+    if (scsi_write_wait(lun) && !writeError) {
+      writeError = 1;
+      scsi_set_sense_data(usb_mass_CBW.bLUN, SCSI_MEDIUM_ERROR, SCSI_WRITE_FAULT);
+    }
     SCSI_counter = 0;
-    usb_mass_bot_set_csw(BOT_CSW_CMD_PASSED, BOT_SEND_CSW_ENABLE);
+    usb_mass_bot_set_csw(writeError ? BOT_CSW_CMD_FAILED : BOT_CSW_CMD_PASSED, BOT_SEND_CSW_ENABLE);
     SCSI_transferState = SCSI_TXFR_IDLE;
     // TODO: Led_RW_OFF();
   }
@@ -60,6 +60,8 @@ extern "C" {
 #define SCSI_ADDRESS_OUT_OF_RANGE                   0x21
 #define SCSI_MEDIUM_NOT_PRESENT 			              0x3A
 #define SCSI_MEDIUM_HAVE_CHANGED			              0x28
+#define SCSI_WRITE_FAULT                            0x03
+#define SCSI_UNRECOVERED_READ_ERROR                 0x11
 
 #define SCSI_READ_FORMAT_CAPACITY_DATA_LEN          0x0C
 #define SCSI_READ_CAPACITY10_DATA_LEN               0x08
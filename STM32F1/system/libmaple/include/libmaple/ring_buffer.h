@@ -40,6 +40,7 @@ extern "C"{
 #endif
 
 #include <libmaple/libmaple_types.h>
+#include <string.h>
 
 /**
  * Ring buffer type.
@@ -193,6 +194,95 @@ static inline int rb_push_insert(ring_buffer *rb, uint8 element) {
     return ret;
 }
 
+/**
+ * @brief Append as many items from a block as will fit.
+ *
+ * Copies with at most two memcpy() calls, one on either side of the
+ * wrap point, and updates the tail once.
+ *
+ * @param rb Ring buffer to insert into.
+ * @param buf Items to insert.
+ * @param len Number of items in buf.
+ * @return Number of items inserted.
+ */
+static inline uint16 rb_write_block(ring_buffer *rb, const uint8 *buf,
+                                    uint16 len) {
+    uint8 *data = (uint8*)rb->buf;
+    uint16 head = rb->head;
+    uint16 tail = rb->tail;
+    uint16 n = 0;
+    uint16 chunk;
+
+    if (tail >= head) {
+        /* Free space runs to the end of the buffer (less one slot if
+         * the head sits at the start). */
+        chunk = rb->size + 1 - tail - (head == 0);
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(data + tail, buf, chunk);
+        tail += chunk;
+        if (tail > rb->size) {
+            tail = 0;
+        }
+        n = chunk;
+    }
+    if (tail < head) {
+        chunk = head - 1 - tail;
+        if (chunk > len - n) {
+            chunk = len - n;
+        }
+        memcpy(data + tail, buf + n, chunk);
+        tail += chunk;
+        n += chunk;
+    }
+    rb->tail = tail;
+    return n;
+}
+
+/**
+ * @brief Remove up to len items from the front of a ring buffer.
+ *
+ * Copies with at most two memcpy() calls, one on either side of the
+ * wrap point, and updates the head once.
+ *
+ * @param rb Ring buffer to remove from.
+ * @param buf Where to store removed items.
+ * @param len Maximum number of items to remove.
+ * @return Number of items removed.
+ */
+static inline uint16 rb_read_block(ring_buffer *rb, uint8 *buf, uint16 len) {
+    const uint8 *data = (const uint8*)rb->buf;
+    uint16 head = rb->head;
+    uint16 tail = rb->tail;
+    uint16 n = 0;
+    uint16 chunk;
+
+    if (tail < head) {
+        chunk = rb->size + 1 - head;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(buf, data + head, chunk);
+        head += chunk;
+        if (head > rb->size) {
+            head = 0;
+        }
+        n = chunk;
+    }
+    if (head < tail) {
+        chunk = tail - head;
+        if (chunk > len - n) {
+            chunk = len - n;
+        }
+        memcpy(buf + n, data + head, chunk);
+        head += chunk;
+        n += chunk;
+    }
+    rb->head = head;
+    return n;
+}
+
 /**
  * @brief Discard all items from a ring buffer.
  * @param rb Ring buffer to discard all items from.
@@ -43,6 +43,7 @@ extern "C"{
 #include <libmaple/rcc.h>
 #include <libmaple/nvic.h>
 #include <libmaple/ring_buffer.h>
+#include <libmaple/dma.h>
 
  /* Roger clark. Replaced with line below #include <series/usart.h>*/
 #include "stm32f1/include/series/usart.h"
@@ -377,6 +378,9 @@ typedef struct usart_reg_map {
  * Devices
  */
 
+/* Default buffer sizes, for ports started without explicit buffers.
+ * See usart_set_buffers(). */
+
 #ifndef USART_RX_BUF_SIZE
 #define USART_RX_BUF_SIZE               64
 #endif
@@ -385,6 +389,63 @@ typedef struct usart_reg_map {
 #define USART_TX_BUF_SIZE               64
 #endif
 
+/**
+ * @brief Serial port error and buffer statistics.
+ *
+ * Updated by the USART interrupt handler. With RX DMA enabled, the
+ * error flags are only sampled once per idle line, and bytes the DMA
+ * channel overwrites before they're read aren't counted as dropped.
+ *
+ * @see usart_reset_stats()
+ */
+typedef struct usart_stats {
+    uint32 overrun;             /**< Overrun errors (ORE) */
+    uint32 framing;             /**< Framing errors (FE); byte discarded */
+    uint32 parity;              /**< Parity errors (PE); byte discarded */
+    uint32 noise;               /**< Noise errors (NE); byte kept */
+    uint32 dropped;             /**< Bytes lost because RX buffer was full */
+    uint16 rx_high_water;       /**< Most bytes ever in the RX buffer */
+    uint16 tx_high_water;       /**< Most bytes ever in the TX buffer */
+} usart_stats;
+
+/*
+ * Framed receive
+ */
+
+/** Most frame buffers a usart_framer can have */
+#define USART_FRAMES_MAX        8
+
+/** Framing modes for usart_frame_enable() */
+typedef enum usart_framing {
+    USART_FRAMING_COBS = 1,     /**< COBS, frames delimited by 0x00 */
+    USART_FRAMING_SLIP = 2,     /**< SLIP (RFC 1055), delimited by 0xC0 */
+} usart_framing;
+
+/**
+ * @brief Framed receive state.
+ *
+ * In framed mode, the USART interrupt handler decodes received bytes
+ * straight into a small pool of frame buffers, and queues complete
+ * frames for the application instead of using the RX ring buffer.
+ *
+ * @see usart_frame_enable()
+ */
+typedef struct usart_framer {
+    uint8 *pool;                /**< nframes buffers of frame_size bytes */
+    uint16 frame_size;          /**< Size of each frame buffer */
+    uint8 nframes;              /**< Number of frame buffers */
+    uint8 mode;                 /**< usart_framing mode */
+    volatile uint8 head;        /**< Next complete frame to hand out */
+    volatile uint8 tail;        /**< Frame buffer being decoded into */
+    uint16 len[USART_FRAMES_MAX]; /**< Length of each complete frame */
+    uint16 pos;                 /**< Bytes decoded into current frame */
+    uint8 left;                 /**< COBS: data bytes left in block */
+    uint8 state;                /**< Decoder state flags */
+    uint32 dropped;             /**< @brief Frames dropped.
+                                 * Because they were malformed, too
+                                 * long, or no frame buffer was free. */
+} usart_framer;
+
 /** USART device type */
 typedef struct usart_dev {
     usart_reg_map *regs;             /**< Register map */
@@ -392,15 +453,38 @@ typedef struct usart_dev {
     ring_buffer *wb;                 /**< TX ring buffer */
     uint32 max_baud;                 /**< @brief Deprecated.
                                       * Maximum baud rate. */
-    uint8 rx_buf[USART_RX_BUF_SIZE]; /**< @brief Deprecated.
-                                      * Actual RX buffer used by rb.
-                                      * This field will be removed in
-                                      * a future release. */
-    uint8 tx_buf[USART_TX_BUF_SIZE]; /**< Actual TX buffer used by wb */
     rcc_clk_id clk_id;               /**< RCC clock information */
     nvic_irq_num irq_num;            /**< USART NVIC interrupt */
+    dma_request_src rx_dma_req;      /**< RX DMA request source, or 0
+                                      * if the port has no RX DMA. */
+    void (*rx_dma_handler)(void);    /**< RX DMA interrupt handler */
+    dma_tube_reg_map *rx_dma_regs;   /**< @brief Active RX DMA channel.
+                                      * NULL unless RX DMA is enabled. */
+    dma_request_src tx_dma_req;      /**< TX DMA request source, or 0
+                                      * if the port has no TX DMA. */
+    void (*tx_dma_handler)(void);    /**< TX DMA interrupt handler */
+    dma_tube_reg_map *tx_dma_regs;   /**< @brief Active TX DMA channel.
+                                      * NULL unless TX DMA is enabled. */
+    volatile uint16 tx_dma_len;      /**< Bytes of wb in flight on TX DMA */
+    usart_stats stats;               /**< Error and buffer statistics */
+    struct gpio_dev *rts_dev;        /**< Software RTS GPIO, or NULL */
+    uint8 rts_bit;                   /**< Software RTS pin on rts_dev */
+    volatile uint8 rts_held;         /**< Software RTS is deasserted */
+    uint16 rts_high;                 /**< @brief Software RTS high mark.
+                                      * RTS is deasserted once the RX
+                                      * buffer holds this many bytes. */
+    uint16 rts_low;                  /**< @brief Software RTS low mark.
+                                      * RTS is reasserted once the RX
+                                      * buffer drains to this many. */
+    struct gpio_dev *de_dev;         /**< RS-485 driver enable GPIO,
+                                      * or NULL */
+    uint8 de_bit;                    /**< RS-485 DE pin on de_dev */
+    usart_framer *framer;            /**< Framed receive state, or NULL */
 } usart_dev;
 
+void usart_set_buffers(usart_dev *dev,
+                       uint8 *rx_buf, uint16 rx_size,
+                       uint8 *tx_buf, uint16 tx_size);
 void usart_init(usart_dev *dev);
 
 struct gpio_dev;                /* forward declaration */
@@ -419,6 +503,42 @@ extern void usart_config_gpios_async(usart_dev *udev,
                                      struct gpio_dev *tx_dev, uint8 tx,
                                      unsigned flags);
 
+/*
+ * Flow control flags for usart_config_gpios_flow()
+ */
+
+/** Hardware CTS: transmission pauses while CTS is high */
+#define USART_FLOW_CTS          0x1
+/** Hardware RTS: RTS goes high while the receive data register is full */
+#define USART_FLOW_RTS          0x2
+/** Software RTS: RTS goes high while the RX buffer is nearly full */
+#define USART_FLOW_RTS_SOFT     0x4
+
+/**
+ * @brief Configure GPIOs and the USART for RTS/CTS flow control.
+ *
+ * Hardware CTS/RTS must use the USART's own CTS/RTS pins, and aren't
+ * available on UART4 and UART5. Software RTS may use any GPIO; it
+ * goes high when the RX buffer reaches 3/4 full and low again when
+ * it drains to 1/4 full (see usart_dev's rts_high and rts_low).
+ *
+ * The port's buffers must already be set. Passing flags of 0 turns
+ * flow control off.
+ *
+ * @param udev   USART device to use
+ * @param cts_dev CTS pin gpio_dev, or NULL if unused
+ * @param cts    CTS pin bit on cts_dev
+ * @param rts_dev RTS pin gpio_dev, or NULL if unused
+ * @param rts    RTS pin bit on rts_dev
+ * @param flags  OR of USART_FLOW_CTS and either USART_FLOW_RTS or
+ *               USART_FLOW_RTS_SOFT
+ */
+extern void usart_config_gpios_flow(usart_dev *udev,
+                                    struct gpio_dev *cts_dev, uint8 cts,
+                                    struct gpio_dev *rts_dev, uint8 rts,
+                                    unsigned flags);
+void usart_rts_release(usart_dev *dev);
+
 #define USART_USE_PCLK 0
 void usart_set_baud_rate(usart_dev *dev, uint32 clock_speed, uint32 baud);
 
@@ -427,7 +547,21 @@ void usart_disable(usart_dev *dev);
 void usart_foreach(void (*fn)(usart_dev *dev));
 uint32 usart_tx(usart_dev *dev, const uint8 *buf, uint32 len);
 uint32 usart_rx(usart_dev *dev, uint8 *buf, uint32 len);
+int usart_rx_dma_enable(usart_dev *dev);
+void usart_rx_dma_disable(usart_dev *dev);
+int usart_tx_dma_enable(usart_dev *dev);
+void usart_tx_dma_disable(usart_dev *dev);
 void usart_putudec(usart_dev *dev, uint32 val);
+void usart_config_rs485(usart_dev *dev, struct gpio_dev *de_dev, uint8 de);
+void usart_set_address(usart_dev *dev, uint8 addr);
+void usart_mute(usart_dev *dev);
+void usart_send_address(usart_dev *dev, uint8 addr);
+int usart_frame_enable(usart_dev *dev, usart_framer *framer,
+                       usart_framing mode, uint8 *pool,
+                       uint16 frame_size, uint8 nframes);
+void usart_frame_disable(usart_dev *dev);
+int32 usart_frame_get(usart_dev *dev, const uint8 **frame);
+void usart_frame_release(usart_dev *dev);
 
 /**
  * @brief Disable all serial ports.
@@ -476,7 +610,11 @@ static inline void usart_putstr(usart_dev *dev, const char* str) {
  * @see usart_data_available()
  */
 static inline uint8 usart_getc(usart_dev *dev) {
-    return rb_remove(dev->rb);
+    uint8 ch = rb_remove(dev->rb);
+    if (dev->rts_held) {
+        usart_rts_release(dev);
+    }
+    return ch;
 }
 
 /*
@@ -500,12 +638,24 @@ static inline uint32 usart_data_available(usart_dev *dev) {
     return rb_full_count(dev->rb);
 }
 
+/**
+ * @brief Zero a serial port's error counters and high-water marks.
+ * @param dev Serial port whose statistics to reset.
+ * @see usart_stats
+ */
+static inline void usart_reset_stats(usart_dev *dev) {
+    memset(&dev->stats, 0, sizeof(dev->stats));
+}
+
 /**
  * @brief Discard the contents of a serial port's RX buffer.
  * @param dev Serial port whose buffer to empty.
  */
 static inline void usart_reset_rx(usart_dev *dev) {
     rb_reset(dev->rb);
+    if (dev->rts_held) {
+        usart_rts_release(dev);
+    }
 }
 
 /**
@@ -81,9 +81,18 @@ extern "C" {
 #define USB_CDCACM_CTRL_TX_ADDR         0x80
 #define USB_CDCACM_CTRL_EPSIZE          0x40
 
+/* The bulk data endpoints are double-buffered, so each has a second
+ * packet buffer (..._ADDR1) that the USB peripheral alternates with
+ * the first. */
 #define USB_CDCACM_TX_ENDP              1
 #define USB_CDCACM_TX_ADDR              0xC0
+#define USB_CDCACM_TX_ADDR1             0x190
 #define USB_CDCACM_TX_EPSIZE            0x40
+/* Writes at least this long go straight to packet memory, see
+ * usb_cdcacm_tx_direct() */
+#ifndef USB_CDCACM_TX_DIRECT_MIN
+#define USB_CDCACM_TX_DIRECT_MIN        (2 * USB_CDCACM_TX_EPSIZE)
+#endif
 
 #define USB_CDCACM_MANAGEMENT_ENDP      2
 #define USB_CDCACM_MANAGEMENT_ADDR      0x100
@@ -91,6 +100,7 @@ extern "C" {
 
 #define USB_CDCACM_RX_ENDP              3
 #define USB_CDCACM_RX_ADDR              0x110
+#define USB_CDCACM_RX_ADDR1             0x150
 #define USB_CDCACM_RX_EPSIZE            0x40
 
 #ifndef __cplusplus
@@ -122,6 +132,7 @@ void usb_cdcacm_disable(gpio_dev*, uint8);
 
 void   usb_cdcacm_putc(char ch);
 uint32 usb_cdcacm_tx(const uint8* buf, uint32 len);
+uint32 usb_cdcacm_tx_direct(const uint8* buf, uint32 len);
 uint32 usb_cdcacm_rx(uint8* buf, uint32 len);
 uint32 usb_cdcacm_peek(uint8* buf, uint32 len);
 uint32 usb_cdcacm_peek_ex(uint8* buf, uint32 offset, uint32 len);
@@ -36,28 +36,157 @@
 
 #include <libmaple/ring_buffer.h>
 #include <libmaple/usart.h>
+#include <libmaple/gpio.h>
+
+/* usart_framer state flags */
+#define USART_FRAMER_BAD        0x1 /* Current frame is being discarded */
+#define USART_FRAMER_ESC        0x2 /* SLIP: previous byte was ESC */
+#define USART_FRAMER_ZERO       0x4 /* COBS: a zero is owed before the
+                                     * next block */
+
+/**
+ * @brief Set the software RTS marks from the RX buffer's capacity.
+ */
+static inline void usart_rts_marks(usart_dev *dev) {
+    uint16 capacity = dev->rb->size;
+    dev->rts_high = capacity - capacity / 4;
+    dev->rts_low = capacity / 4;
+}
+
+/**
+ * @brief Deassert software RTS if the RX buffer is over its high mark.
+ */
+static inline void usart_rts_check(usart_dev *dev, uint16 count) {
+    if (dev->rts_dev && !dev->rts_held && count >= dev->rts_high) {
+        gpio_write_bit(dev->rts_dev, dev->rts_bit, 1);
+        dev->rts_held = 1;
+    }
+}
+
+/**
+ * @brief Publish bytes received by RX DMA to the RX ring buffer.
+ *
+ * The DMA channel writes into rb->buf in circular mode, so the ring
+ * buffer's tail is simply the channel's current write position.
+ */
+static inline void usart_rx_dma_sync(usart_dev *dev) {
+    ring_buffer *rb = dev->rb;
+    uint16 tail = rb->size + 1 - dev->rx_dma_regs->CNDTR;
+    uint16 count;
+    rb->tail = (tail > rb->size) ? 0 : tail;
+    count = rb_full_count(rb);
+    if (count > dev->stats.rx_high_water) {
+        dev->stats.rx_high_water = count;
+    }
+    usart_rts_check(dev, count);
+}
+
+/**
+ * @brief Count the error flags in a status register value.
+ */
+static inline void usart_count_errors(usart_dev *dev, uint32 sr) {
+    if (sr & USART_SR_ORE) {
+        dev->stats.overrun++;
+    }
+    if (sr & USART_SR_FE) {
+        dev->stats.framing++;
+    }
+    if (sr & USART_SR_PE) {
+        dev->stats.parity++;
+    }
+    if (sr & USART_SR_NE) {
+        dev->stats.noise++;
+    }
+}
+
+/**
+ * @brief Start TX DMA on the longest contiguous span of the TX buffer.
+ *
+ * Does nothing if the TX buffer is empty. Must only be called while
+ * no TX DMA transfer is in flight (i.e. dev->tx_dma_len is zero).
+ */
+static inline void usart_tx_dma_start(usart_dev *dev) {
+    ring_buffer *wb = dev->wb;
+    dma_tube_reg_map *chregs = dev->tx_dma_regs;
+    uint16 head = wb->head;
+    uint16 tail = wb->tail;
+
+    if (head == tail) {
+        return;
+    }
+    /* Stop at the end of the buffer; the rest goes out after the
+     * wrap-around, on the next transfer complete interrupt. */
+    dev->tx_dma_len = (tail > head ? tail : wb->size + 1) - head;
+    chregs->CCR &= ~DMA_CCR_EN;
+    chregs->CMAR = (uint32)&wb->buf[head];
+    chregs->CNDTR = dev->tx_dma_len;
+    dev->regs->SR = ~USART_SR_TC; /* so flush() waits for this span */
+    chregs->CCR |= DMA_CCR_EN;
+}
+
+/**
+ * @brief TX DMA transfer complete: release the span, send the next one.
+ */
+static inline void usart_tx_dma_irq(usart_dev *dev) {
+    ring_buffer *wb = dev->wb;
+    uint16 head = wb->head + dev->tx_dma_len;
+
+    wb->head = (head > wb->size) ? 0 : head;
+    dev->tx_dma_len = 0;
+    usart_tx_dma_start(dev);
+}
+
+void _usart_frame_rx(usart_framer *f, uint8 byte);
+
+static inline void usart_irq(usart_dev *dev) {
+    usart_reg_map *regs = dev->regs;
+    ring_buffer *rb = dev->rb;
+    ring_buffer *wb = dev->wb;
+    uint32 sr = regs->SR;
 
-static inline void usart_irq(ring_buffer *rb, ring_buffer *wb, usart_reg_map *regs) {
     /* Handling RXNEIE and TXEIE interrupts. 
      * RXNE signifies availability of a byte in DR.
      *
      * See table 198 (sec 27.4, p809) in STM document RM0008 rev 15.
      * We enable RXNEIE. */
-    if ((regs->CR1 & USART_CR1_RXNEIE) && (regs->SR & USART_SR_RXNE)) {
-        if( regs->SR & USART_SR_FE || regs->SR & USART_SR_PE ) {
+    if ((regs->CR1 & USART_CR1_RXNEIE) && (sr & USART_SR_RXNE)) {
+        usart_count_errors(dev, sr);
+        if (sr & (USART_SR_FE | USART_SR_PE)) {
            // framing error or parity error
            regs->DR; //read and throw away the data, this clears FE and PE as well
+           if (dev->framer) {
+               dev->framer->state |= USART_FRAMER_BAD;
+           }
+       } else if (dev->framer) {
+            _usart_frame_rx(dev->framer, (uint8)regs->DR);
        } else {
+            uint16 count;
 #ifdef USART_SAFE_INSERT
             /* If the buffer is full and the user defines USART_SAFE_INSERT,
             * ignore new bytes. */
-            rb_safe_insert(rb, (uint8)regs->DR);
+            if (!rb_safe_insert(rb, (uint8)regs->DR)) {
+                dev->stats.dropped++;
+            }
 #else
             /* By default, push bytes around in the ring buffer. */
-            rb_push_insert(rb, (uint8)regs->DR);
+            if (rb_push_insert(rb, (uint8)regs->DR) >= 0) {
+                dev->stats.dropped++;
+            }
 #endif
+            count = rb_full_count(rb);
+            if (count > dev->stats.rx_high_water) {
+                dev->stats.rx_high_water = count;
+            }
+            usart_rts_check(dev, count);
        }
     }
+    /* IDLE signifies the end of a burst received by RX DMA. Reading
+     * DR after SR clears the flag, along with any error flags. */
+    if ((regs->CR1 & USART_CR1_IDLEIE) && (sr & USART_SR_IDLE)) {
+        usart_count_errors(dev, sr);
+        regs->DR;
+        usart_rx_dma_sync(dev);
+    }
     /* TXE signifies readiness to send a byte to DR. */
     if ((regs->CR1 & USART_CR1_TXEIE) && (regs->SR & USART_SR_TXE)) {
         if (!rb_is_empty(wb))
@@ -65,6 +194,14 @@ static inline void usart_irq(ring_buffer *rb, ring_buffer *wb, usart_reg_map *re
         else
             regs->CR1 &= ~((uint32)USART_CR1_TXEIE); // disable TXEIE
     }
+    /* TC signifies the line has gone quiet: release the RS-485 driver,
+     * unless more data has been queued since. */
+    if ((regs->CR1 & USART_CR1_TCIE) && (regs->SR & USART_SR_TC)) {
+        if (rb_is_empty(wb) && !dev->tx_dma_len) {
+            regs->CR1 &= ~((uint32)USART_CR1_TCIE);
+            gpio_write_bit(dev->de_dev, dev->de_bit, 0);
+        }
+    }
 }
 
 uint32 _usart_clock_freq(usart_dev *dev);
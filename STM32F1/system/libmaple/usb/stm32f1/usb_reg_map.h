@@ -567,7 +567,7 @@ static inline uint16 usb_get_ep_rx_buf0_count(uint8 ep) {
     return usb_get_ep_tx_count(ep);
 }
 
-//void usb_set_ep_rx_buf0_count(uint8 ep, uint16 count);
+void usb_set_ep_rx_buf0_count(uint8 ep, uint16 count);
 
 static inline uint32* usb_ep_rx_buf1_count_ptr(uint8 ep) {
     return usb_ep_rx_count_ptr(ep);